@@ -18,7 +18,7 @@ include $(CLEAR_VARS)
 
 LOCAL_MODULE := audio.primary.tuna
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
-LOCAL_SRC_FILES := audio_hw.c ril_interface.c
+LOCAL_SRC_FILES := audio_hw.c ril_interface.c pcm_utils.c
 LOCAL_C_INCLUDES += \
 	external/tinyalsa/include \
 	$(call include-path-for, audio-utils) \
@@ -39,3 +39,23 @@ endif
 
 include $(BUILD_SHARED_LIBRARY)
 
+
+# pcm_utils against a reference loop: NEON kernels on the target, scalar
+# fallback on the host.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio.primary.tuna_pcm_utils_test
+LOCAL_SRC_FILES := pcm_utils.c tests/pcm_utils_test.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio.primary.tuna_pcm_utils_test
+LOCAL_SRC_FILES := pcm_utils.c tests/pcm_utils_test.cpp
+LOCAL_C_INCLUDES += $(LOCAL_PATH)
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_NATIVE_TEST)
@@ -18,8 +18,10 @@
 /*#define LOG_NDEBUG 0*/
 
 #include <errno.h>
+#include <stdio.h>
 #include <sys/time.h>
 
+#include <cutils/atomic.h>
 #include <cutils/log.h>
 #include <cutils/str_parms.h>
 #include <cutils/properties.h>
@@ -27,6 +29,7 @@
 #include <hardware/hardware.h>
 
 #include "audio_hw.h"
+#include "pcm_utils.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
@@ -50,13 +53,19 @@ struct pcm_config pcm_config_tones = {
     .period_size = SHORT_PERIOD_SIZE,
     .period_count = PLAYBACK_SHORT_PERIOD_COUNT,
     .format = PCM_FORMAT_S16_LE,
-#ifdef PLAYBACK_MMAP
-    .start_threshold = SHORT_PERIOD_SIZE,
-    .avail_min = SHORT_PERIOD_SIZE,
-#else
     .start_threshold = 0,
     .avail_min = 0,
-#endif
+};
+
+/* low latency, mmap no-irq mode */
+struct pcm_config pcm_config_tones_mmap = {
+    .channels = 2,
+    .rate = MM_FULL_POWER_SAMPLING_RATE, /* changed based on audio policy setting */
+    .period_size = SHORT_PERIOD_SIZE,
+    .period_count = PLAYBACK_MMAP_SHORT_PERIOD_COUNT,
+    .format = PCM_FORMAT_S16_LE,
+    .start_threshold = SHORT_PERIOD_SIZE,
+    .avail_min = SHORT_PERIOD_SIZE,
 };
 
 #ifdef USE_HDMI_AUDIO
@@ -93,6 +102,11 @@ struct pcm_config pcm_config_vx = {
 /**
  * NOTE: when multiple mutexes have to be acquired, always respect the following order:
  *        hw device > in stream > out stream
+ *
+ * The read and write paths only take the hw device mutex to leave standby. Stream
+ * mutexes are acquired through lock_output_stream()/lock_input_stream() so that a
+ * thread waiting for the stream mutex - e.g. executing select_mode() while holding
+ * the hw device mutex - is not starved by the playback or capture thread.
  */
 
 
@@ -103,34 +117,136 @@ static int do_input_standby(struct tuna_stream_in *in);
 static int do_output_standby(struct tuna_stream_out *out);
 static void in_update_aux_channels(struct tuna_stream_in *in, effect_handle_t effect);
 
+static void lock_output_stream(struct tuna_stream_out *out)
+{
+    pthread_mutex_lock(&out->pre_lock);
+    pthread_mutex_lock(&out->lock);
+    pthread_mutex_unlock(&out->pre_lock);
+}
+
+static void lock_input_stream(struct tuna_stream_in *in)
+{
+    pthread_mutex_lock(&in->pre_lock);
+    pthread_mutex_lock(&in->lock);
+    pthread_mutex_unlock(&in->pre_lock);
+}
+
+/* must be called with hw device mutex locked.
+ * Publishes whether deep buffer playback may use long periods, so that
+ * out_write_deep_buffer() does not need the hw device mutex to find out. */
+static void update_long_periods(struct tuna_audio_device *adev)
+{
+    android_atomic_release_store(adev->screen_off && !adev->active_input,
+                                 &adev->long_periods);
+}
+
+/* Returns the shadow of the named mixer control, allocating it the first time the
+ * control is asked for. All writes to a control go through its shadow so that values
+ * which are already set are not written again. */
+static struct mixer_shadow *get_mixer_shadow(struct tuna_audio_device *adev, const char *name)
+{
+    struct mixer_ctl *ctl;
+    unsigned int i;
+
+    ctl = mixer_get_ctl_by_name(adev->mixer, name);
+    if (!ctl)
+        return NULL;
+
+    for (i = 0; i < adev->num_mixer_shadows; i++) {
+        if (adev->mixer_shadows[i].ctl == ctl)
+            return &adev->mixer_shadows[i];
+    }
+
+    if (i == MAX_MIXER_SHADOWS) {
+        ALOGE("get_mixer_shadow(): too many mixer controls, cannot add %s", name);
+        return NULL;
+    }
+    memset(&adev->mixer_shadows[i], 0, sizeof(adev->mixer_shadows[i]));
+    adev->mixer_shadows[i].ctl = ctl;
+    adev->mixer_shadows[i].num_values = mixer_ctl_get_num_values(ctl);
+    adev->num_mixer_shadows++;
+
+    return &adev->mixer_shadows[i];
+}
+
+/* Sets the first num_values values of a control (i.e. both channels of a stereo
+ * volume) to value, skipping those that already have it. */
+static void set_mixer_value(struct mixer_shadow *shadow, unsigned int num_values, int value)
+{
+    bool shadowed = shadow->num_values <= MIXER_SHADOW_MAX_VALUES;
+    unsigned int i;
+    int ret;
+
+    if (shadow->strval) {
+        memset(shadow->valid, 0, sizeof(shadow->valid));
+        shadow->strval = NULL;
+    }
+
+    for (i = 0; i < num_values; i++) {
+        if (shadowed && shadow->valid[i] && shadow->intval[i] == value)
+            continue;
+        ret = mixer_ctl_set_value(shadow->ctl, i, value);
+        if (shadowed) {
+            shadow->valid[i] = (ret == 0);
+            shadow->intval[i] = value;
+        }
+    }
+}
+
+static void set_mixer_enum(struct mixer_shadow *shadow, const char *strval)
+{
+    if (shadow->valid[0] && shadow->strval && strcmp(shadow->strval, strval) == 0)
+        return;
+
+    memset(shadow->valid, 0, sizeof(shadow->valid));
+    shadow->valid[0] = (mixer_ctl_set_enum_by_string(shadow->ctl, strval) == 0);
+    shadow->strval = strval;
+}
+
+/* Resolves the mixer controls of a route array into the device's shadows, once when
+ * the device is opened. The route tables themselves are shared and never written. */
+static int resolve_route_by_array(struct tuna_audio_device *adev, enum route_id id)
+{
+    const struct route_setting *route = all_routes[id];
+    unsigned int i;
+    int ret = 0;
+
+    for (i = 0; route[i].ctl_name; i++) {
+        if (i == MAX_ROUTE_SETTINGS) {
+            ALOGE("resolve_route_by_array(): route %d has too many controls", id);
+            return -EINVAL;
+        }
+        adev->route_shadows[id][i] = get_mixer_shadow(adev, route[i].ctl_name);
+        if (!adev->route_shadows[id][i]) {
+            ALOGE("resolve_route_by_array(): cannot use mixer control %s", route[i].ctl_name);
+            ret = -EINVAL;
+        }
+    }
+
+    return ret;
+}
+
 /* The enable flag when 0 makes the assumption that enums are disabled by
  * "Off" and integers/booleans by 0 */
-static int set_route_by_array(struct mixer *mixer, struct route_setting *route,
-                              int enable)
+static int set_route_by_array(struct tuna_audio_device *adev, enum route_id id, int enable)
 {
-    struct mixer_ctl *ctl;
-    unsigned int i, j;
+    const struct route_setting *route = all_routes[id];
+    struct mixer_shadow *shadow;
+    unsigned int i;
 
     /* Go through the route array and set each value */
     i = 0;
     while (route[i].ctl_name) {
-        ctl = mixer_get_ctl_by_name(mixer, route[i].ctl_name);
-        if (!ctl)
+        shadow = i < MAX_ROUTE_SETTINGS ? adev->route_shadows[id][i] : NULL;
+        if (!shadow)
             return -EINVAL;
 
         if (route[i].strval) {
-            if (enable)
-                mixer_ctl_set_enum_by_string(ctl, route[i].strval);
-            else
-                mixer_ctl_set_enum_by_string(ctl, "Off");
+            set_mixer_enum(shadow, enable ? route[i].strval : "Off");
         } else {
             /* This ensures multiple (i.e. stereo) values are set jointly */
-            for (j = 0; j < mixer_ctl_get_num_values(ctl); j++) {
-                if (enable)
-                    mixer_ctl_set_value(ctl, j, route[i].intval);
-                else
-                    mixer_ctl_set_value(ctl, j, 0);
-            }
+            set_mixer_value(shadow, mixer_ctl_get_num_values(shadow->ctl),
+                            enable ? route[i].intval : 0);
         }
         i++;
     }
@@ -197,9 +313,9 @@ static void set_eq_filter(struct tuna_audio_device *adev)
     /* 4Khz LPF is used only in NB-AMR voicecall */
     if ((adev->mode == AUDIO_MODE_IN_CALL) && dl1_eq_applicable &&
             (adev->tty_mode == TTY_MODE_OFF) && !adev->wb_amr)
-        mixer_ctl_set_enum_by_string(adev->mixer_ctls.dl1_eq, MIXER_4KHZ_LPF_0DB);
+        set_mixer_enum(adev->mixer_ctls.dl1_eq, MIXER_4KHZ_LPF_0DB);
     else
-        mixer_ctl_set_enum_by_string(adev->mixer_ctls.dl1_eq, MIXER_FLAT_RESPONSE);
+        set_mixer_enum(adev->mixer_ctls.dl1_eq, MIXER_FLAT_RESPONSE);
 }
 
 void audio_set_wb_amr_callback(void *data, int enable)
@@ -259,7 +375,6 @@ static void set_incall_device(struct tuna_audio_device *adev)
 static void set_input_volumes(struct tuna_audio_device *adev, int main_mic_on,
                               int headset_mic_on, int sub_mic_on)
 {
-    unsigned int channel;
     int volume = MIXER_ABE_GAIN_0DB;
 
     if (adev->mode == AUDIO_MODE_IN_CALL) {
@@ -301,13 +416,11 @@ static void set_input_volumes(struct tuna_audio_device *adev, int main_mic_on,
         }
     }
 
-    for (channel = 0; channel < 2; channel++)
-        mixer_ctl_set_value(adev->mixer_ctls.amic_ul_volume, channel, volume);
+    set_mixer_value(adev->mixer_ctls.amic_ul_volume, 2, volume);
 }
 
 static void set_output_volumes(struct tuna_audio_device *adev, bool tty_volume)
 {
-    unsigned int channel;
     int speaker_volume;
     int headset_volume;
     int earpiece_volume;
@@ -315,7 +428,7 @@ static void set_output_volumes(struct tuna_audio_device *adev, bool tty_volume)
     int speaker_on = adev->out_device & AUDIO_DEVICE_OUT_SPEAKER;
     int speaker_volume_overrange = MIXER_ABE_GAIN_0DB;
     int speaker_max_db =
-        DB_FROM_SPEAKER_VOLUME(mixer_ctl_get_range_max(adev->mixer_ctls.speaker_volume));
+        DB_FROM_SPEAKER_VOLUME(mixer_ctl_get_range_max(adev->mixer_ctls.speaker_volume->ctl));
     int normal_speaker_volume = NORMAL_SPEAKER_VOLUME;
     int normal_headphone_volume = NORMAL_HEADPHONE_VOLUME;
     int normal_headset_volume = NORMAL_HEADSET_VOLUME;
@@ -369,42 +482,40 @@ static void set_output_volumes(struct tuna_audio_device *adev, bool tty_volume)
         speaker_volume = speaker_max_db;
     }
 
-    for (channel = 0; channel < 2; channel++) {
-        mixer_ctl_set_value(adev->mixer_ctls.speaker_volume, channel,
-            DB_TO_SPEAKER_VOLUME(speaker_volume));
-        mixer_ctl_set_value(adev->mixer_ctls.headset_volume, channel,
-            DB_TO_HEADSET_VOLUME(headset_volume));
-    }
+    set_mixer_value(adev->mixer_ctls.speaker_volume, 2,
+        DB_TO_SPEAKER_VOLUME(speaker_volume));
+    set_mixer_value(adev->mixer_ctls.headset_volume, 2,
+        DB_TO_HEADSET_VOLUME(headset_volume));
 
     if (!speaker_on)
         speaker_volume_overrange = MIXER_ABE_GAIN_0DB;
 
     if (adev->mode == AUDIO_MODE_IN_CALL) {
-        mixer_ctl_set_value(adev->mixer_ctls.tones_dl1_volume, 0,
+        set_mixer_value(adev->mixer_ctls.tones_dl1_volume, 1,
                             MIXER_ABE_GAIN_0DB + dl1_volume_correction);
-        mixer_ctl_set_value(adev->mixer_ctls.vx_dl2_volume, 0,
+        set_mixer_value(adev->mixer_ctls.vx_dl2_volume, 1,
                                 speaker_volume_overrange);
-        mixer_ctl_set_value(adev->mixer_ctls.tones_dl2_volume, 0,
+        set_mixer_value(adev->mixer_ctls.tones_dl2_volume, 1,
                                 speaker_volume_overrange + dl2_volume_correction);
     } else if ((adev->mode == AUDIO_MODE_IN_COMMUNICATION) ||
 		    (adev->mode == AUDIO_MODE_RINGTONE)) {
-        mixer_ctl_set_value(adev->mixer_ctls.tones_dl1_volume, 0,
+        set_mixer_value(adev->mixer_ctls.tones_dl1_volume, 1,
                             MIXER_ABE_GAIN_0DB);
-        mixer_ctl_set_value(adev->mixer_ctls.tones_dl2_volume, 0,
+        set_mixer_value(adev->mixer_ctls.tones_dl2_volume, 1,
                                 speaker_volume_overrange);
     } else {
-        mixer_ctl_set_value(adev->mixer_ctls.tones_dl1_volume, 0,
+        set_mixer_value(adev->mixer_ctls.tones_dl1_volume, 1,
                             MIXER_ABE_GAIN_0DB + dl1_volume_correction);
-        mixer_ctl_set_value(adev->mixer_ctls.tones_dl2_volume, 0,
+        set_mixer_value(adev->mixer_ctls.tones_dl2_volume, 1,
                                 speaker_volume_overrange + dl2_volume_correction);
     }
 
-    mixer_ctl_set_value(adev->mixer_ctls.mm_dl1_volume, 0,
+    set_mixer_value(adev->mixer_ctls.mm_dl1_volume, 1,
                         MIXER_ABE_GAIN_0DB + dl1_volume_correction);
-    mixer_ctl_set_value(adev->mixer_ctls.mm_dl2_volume, 0,
+    set_mixer_value(adev->mixer_ctls.mm_dl2_volume, 1,
                             speaker_volume_overrange + dl2_volume_correction);
 
-    mixer_ctl_set_value(adev->mixer_ctls.earpiece_volume, 0,
+    set_mixer_value(adev->mixer_ctls.earpiece_volume, 1,
         DB_TO_EARPIECE_VOLUME(earpiece_volume));
 }
 
@@ -418,14 +529,14 @@ static void force_all_standby(struct tuna_audio_device *adev)
     if (adev->outputs[OUTPUT_LOW_LATENCY] != NULL &&
             !adev->outputs[OUTPUT_LOW_LATENCY]->standby) {
         out = adev->outputs[OUTPUT_LOW_LATENCY];
-        pthread_mutex_lock(&out->lock);
+        lock_output_stream(out);
         do_output_standby(out);
         pthread_mutex_unlock(&out->lock);
     }
 
     if (adev->active_input) {
         in = adev->active_input;
-        pthread_mutex_lock(&in->lock);
+        lock_input_stream(in);
         do_input_standby(in);
         pthread_mutex_unlock(&in->lock);
     }
@@ -480,15 +591,12 @@ static void select_output_device(struct tuna_audio_device *adev)
     int dl1_on;
     int sidetone_capture_on = 0;
     bool tty_volume = false;
-    unsigned int channel;
 
     /* Mute VX_UL to avoid pop noises in the tx path
      * during call before switch changes.
      */
     if (adev->mode == AUDIO_MODE_IN_CALL) {
-        for (channel = 0; channel < 2; channel++)
-            mixer_ctl_set_value(adev->mixer_ctls.voice_ul_volume,
-                                channel, 0);
+        set_mixer_value(adev->mixer_ctls.voice_ul_volume, 2, 0);
     }
 
     headset_on = adev->out_device & AUDIO_DEVICE_OUT_WIRED_HEADSET;
@@ -531,25 +639,25 @@ static void select_output_device(struct tuna_audio_device *adev)
     dl1_on = headset_on | headphone_on | earpiece_on | bt_on;
 
     /* Select front end */
-    mixer_ctl_set_value(adev->mixer_ctls.mm_dl2, 0, speaker_on);
-    mixer_ctl_set_value(adev->mixer_ctls.tones_dl2, 0, speaker_on);
-    mixer_ctl_set_value(adev->mixer_ctls.vx_dl2, 0,
+    set_mixer_value(adev->mixer_ctls.mm_dl2, 1, speaker_on);
+    set_mixer_value(adev->mixer_ctls.tones_dl2, 1, speaker_on);
+    set_mixer_value(adev->mixer_ctls.vx_dl2, 1,
                         speaker_on && (adev->mode == AUDIO_MODE_IN_CALL));
-    mixer_ctl_set_value(adev->mixer_ctls.mm_dl1, 0, dl1_on);
-    mixer_ctl_set_value(adev->mixer_ctls.tones_dl1, 0, dl1_on);
-    mixer_ctl_set_value(adev->mixer_ctls.vx_dl1, 0,
+    set_mixer_value(adev->mixer_ctls.mm_dl1, 1, dl1_on);
+    set_mixer_value(adev->mixer_ctls.tones_dl1, 1, dl1_on);
+    set_mixer_value(adev->mixer_ctls.vx_dl1, 1,
                         dl1_on && (adev->mode == AUDIO_MODE_IN_CALL));
     /* Select back end */
-    mixer_ctl_set_value(adev->mixer_ctls.dl1_headset, 0,
+    set_mixer_value(adev->mixer_ctls.dl1_headset, 1,
                         headset_on | headphone_on | earpiece_on);
-    mixer_ctl_set_value(adev->mixer_ctls.dl1_bt, 0, bt_on);
-    mixer_ctl_set_value(adev->mixer_ctls.dl2_mono, 0,
+    set_mixer_value(adev->mixer_ctls.dl1_bt, 1, bt_on);
+    set_mixer_value(adev->mixer_ctls.dl2_mono, 1,
                         (adev->mode != AUDIO_MODE_IN_CALL) && speaker_on);
-    mixer_ctl_set_value(adev->mixer_ctls.earpiece_enable, 0, earpiece_on);
+    set_mixer_value(adev->mixer_ctls.earpiece_enable, 1, earpiece_on);
 
     /* select output stage */
-    set_route_by_array(adev->mixer, hs_output, headset_on | headphone_on);
-    set_route_by_array(adev->mixer, hf_output, speaker_on);
+    set_route_by_array(adev, ROUTE_HS_OUTPUT, headset_on | headphone_on);
+    set_route_by_array(adev, ROUTE_HF_OUTPUT, speaker_on);
 
     set_eq_filter(adev);
     set_output_volumes(adev, tty_volume);
@@ -559,7 +667,7 @@ static void select_output_device(struct tuna_audio_device *adev)
        todo: use sub mic for handsfree case */
     if (adev->mode == AUDIO_MODE_IN_CALL) {
         if (bt_on)
-            set_route_by_array(adev->mixer, vx_ul_bt, bt_on);
+            set_route_by_array(adev, ROUTE_VX_UL_BT, bt_on);
         else {
             /* force tx path according to TTY mode when in call */
             switch(adev->tty_mode) {
@@ -584,16 +692,16 @@ static void select_output_device(struct tuna_audio_device *adev)
             }
 
             if (headset_on || headphone_on || earpiece_on)
-                set_route_by_array(adev->mixer, vx_ul_amic_left, 1);
+                set_route_by_array(adev, ROUTE_VX_UL_AMIC_LEFT, 1);
             else if (speaker_on)
-                set_route_by_array(adev->mixer, vx_ul_amic_right, 1);
+                set_route_by_array(adev, ROUTE_VX_UL_AMIC_RIGHT, 1);
             else
-                set_route_by_array(adev->mixer, vx_ul_amic_left, 0);
+                set_route_by_array(adev, ROUTE_VX_UL_AMIC_LEFT, 0);
 
-            mixer_ctl_set_enum_by_string(adev->mixer_ctls.left_capture,
+            set_mixer_enum(adev->mixer_ctls.left_capture,
                                         (earpiece_on || headphone_on) ? MIXER_MAIN_MIC :
                                         (headset_on ? MIXER_HS_MIC : "Off"));
-            mixer_ctl_set_enum_by_string(adev->mixer_ctls.right_capture,
+            set_mixer_enum(adev->mixer_ctls.right_capture,
                                          speaker_on ? MIXER_SUB_MIC : "Off");
 
             set_input_volumes(adev, earpiece_on || headphone_on,
@@ -606,13 +714,10 @@ static void select_output_device(struct tuna_audio_device *adev)
         set_incall_device(adev);
 
         /* Unmute VX_UL after the switch */
-        for (channel = 0; channel < 2; channel++) {
-            mixer_ctl_set_value(adev->mixer_ctls.voice_ul_volume,
-                                channel, MIXER_ABE_GAIN_0DB);
-        }
+        set_mixer_value(adev->mixer_ctls.voice_ul_volume, 2, MIXER_ABE_GAIN_0DB);
     }
 
-    mixer_ctl_set_value(adev->mixer_ctls.sidetone_capture, 0, sidetone_capture_on);
+    set_mixer_value(adev->mixer_ctls.sidetone_capture, 1, sidetone_capture_on);
 }
 
 static void select_input_device(struct tuna_audio_device *adev)
@@ -639,7 +744,7 @@ static void select_input_device(struct tuna_audio_device *adev)
     * both use cases are mutually exclusive.
     */
     if (bt_on)
-        set_route_by_array(adev->mixer, mm_ul2_bt, 1);
+        set_route_by_array(adev, ROUTE_MM_UL2_BT, 1);
     else {
         /* Select front end */
 
@@ -649,31 +754,31 @@ static void select_input_device(struct tuna_audio_device *adev)
             ALOGV("select input device(): multi-mic configuration main mic %s sub mic %s",
                   main_mic_on ? "ON" : "OFF", sub_mic_on ? "ON" : "OFF");
             if (main_mic_on) {
-                set_route_by_array(adev->mixer, mm_ul2_amic_dual_main_sub, 1);
+                set_route_by_array(adev, ROUTE_MM_UL2_AMIC_DUAL_MAIN_SUB, 1);
                 sub_mic_on = 1;
             }
             else if (sub_mic_on) {
-                set_route_by_array(adev->mixer, mm_ul2_amic_dual_sub_main, 1);
+                set_route_by_array(adev, ROUTE_MM_UL2_AMIC_DUAL_SUB_MAIN, 1);
                 main_mic_on = 1;
             }
             else {
-                set_route_by_array(adev->mixer, mm_ul2_amic_dual_main_sub, 0);
+                set_route_by_array(adev, ROUTE_MM_UL2_AMIC_DUAL_MAIN_SUB, 0);
             }
         } else {
             ALOGV("select input device(): single mic configuration");
             if (main_mic_on || headset_on)
-                set_route_by_array(adev->mixer, mm_ul2_amic_left, 1);
+                set_route_by_array(adev, ROUTE_MM_UL2_AMIC_LEFT, 1);
             else if (sub_mic_on)
-                set_route_by_array(adev->mixer, mm_ul2_amic_right, 1);
+                set_route_by_array(adev, ROUTE_MM_UL2_AMIC_RIGHT, 1);
             else
-                set_route_by_array(adev->mixer, mm_ul2_amic_left, 0);
+                set_route_by_array(adev, ROUTE_MM_UL2_AMIC_LEFT, 0);
         }
 
 
         /* Select back end */
-        mixer_ctl_set_enum_by_string(adev->mixer_ctls.right_capture,
+        set_mixer_enum(adev->mixer_ctls.right_capture,
                                      sub_mic_on ? MIXER_SUB_MIC : "Off");
-        mixer_ctl_set_enum_by_string(adev->mixer_ctls.left_capture,
+        set_mixer_enum(adev->mixer_ctls.left_capture,
                                      main_mic_on ? MIXER_MAIN_MIC :
                                      (headset_on ? MIXER_HS_MIC : "Off"));
     }
@@ -685,11 +790,8 @@ static void select_input_device(struct tuna_audio_device *adev)
 static int start_output_stream_low_latency(struct tuna_stream_out *out)
 {
     struct tuna_audio_device *adev = out->dev;
-#ifdef PLAYBACK_MMAP
-    unsigned int flags = PCM_OUT | PCM_MMAP | PCM_NOIRQ;
-#else
-    unsigned int flags = PCM_OUT;
-#endif
+    const struct pcm_config *config = out->use_mmap ? &pcm_config_tones_mmap : &pcm_config_tones;
+    unsigned int flags = out->use_mmap ? PCM_OUT | PCM_MMAP | PCM_NOIRQ : PCM_OUT;
     int i;
     bool success = true;
 
@@ -703,7 +805,7 @@ static int start_output_stream_low_latency(struct tuna_stream_out *out)
 
     if (adev->out_device & ~(AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET | AUDIO_DEVICE_OUT_AUX_DIGITAL)) {
         /* Something not a dock in use */
-        out->config[PCM_NORMAL] = pcm_config_tones;
+        out->config[PCM_NORMAL] = *config;
 #ifndef USE_VARIABLE_SAMPLING_RATE
         out->config[PCM_NORMAL].rate = MM_FULL_POWER_SAMPLING_RATE;
 #else
@@ -718,7 +820,7 @@ static int start_output_stream_low_latency(struct tuna_stream_out *out)
 
     if (adev->out_device & AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET) {
         /* SPDIF output in use */
-        out->config[PCM_SPDIF] = pcm_config_tones;
+        out->config[PCM_SPDIF] = *config;
 #ifndef USE_VARIABLE_SAMPLING_RATE
         out->config[PCM_SPDIF].rate = MM_FULL_POWER_SAMPLING_RATE;
 #else
@@ -736,7 +838,7 @@ static int start_output_stream_low_latency(struct tuna_stream_out *out)
     if ((adev->out_device & AUDIO_DEVICE_OUT_AUX_DIGITAL) &&
             (adev->outputs[OUTPUT_HDMI] == NULL || adev->outputs[OUTPUT_HDMI]->standby)) {
         /* HDMI output in use */
-        out->config[PCM_HDMI] = pcm_config_tones;
+        out->config[PCM_HDMI] = *config;
         out->config[PCM_HDMI].rate = MM_LOW_POWER_SAMPLING_RATE;
         out->pcm[PCM_HDMI] = pcm_open(CARD_OMAP4_HDMI, PORT_HDMI,
                                           flags, &out->config[PCM_HDMI]);
@@ -754,17 +856,13 @@ static int start_output_stream_low_latency(struct tuna_stream_out *out)
     }
 
     if (success) {
-#ifdef OUT_RESAMPLER
-        out->buffer_frames = pcm_config_tones.period_size * 2;
-        if (out->buffer == NULL)
-            out->buffer = malloc(out->buffer_frames * audio_stream_out_frame_size(&out->stream));
-#endif
-
         if (adev->echo_reference != NULL)
             out->echo_reference = adev->echo_reference;
 #ifdef OUT_RESAMPLER
         out->resampler->reset(out->resampler);
 #endif
+        out->write_threshold = PLAYBACK_MMAP_WRITE_THRES;
+        out->running = false;
 
         return 0;
     }
@@ -809,12 +907,6 @@ static int start_output_stream_deep_buffer(struct tuna_stream_out *out)
         out->write_threshold = DEEP_BUFFER_SHORT_PERIOD_WRITE_THRES;
     }
 
-#ifdef OUT_RESAMPLER
-    out->buffer_frames = DEEP_BUFFER_SHORT_PERIOD_SIZE * 2;
-    if (out->buffer == NULL)
-        out->buffer = malloc(out->buffer_frames * audio_stream_out_frame_size(&out->stream));
-#endif
-
     return 0;
 }
 
@@ -827,7 +919,7 @@ static int start_output_stream_hdmi(struct tuna_stream_out *out)
     if (adev->outputs[OUTPUT_LOW_LATENCY] != NULL &&
             !adev->outputs[OUTPUT_LOW_LATENCY]->standby) {
         struct tuna_stream_out *ll_out = adev->outputs[OUTPUT_LOW_LATENCY];
-        pthread_mutex_lock(&ll_out->lock);
+        lock_output_stream(ll_out);
         do_output_standby(ll_out);
         pthread_mutex_unlock(&ll_out->lock);
     }
@@ -889,7 +981,7 @@ static size_t get_input_buffer_size(uint32_t sample_rate, audio_format_t format,
 static void add_echo_reference(struct tuna_stream_out *out,
                                struct echo_reference_itfe *reference)
 {
-    pthread_mutex_lock(&out->lock);
+    lock_output_stream(out);
     out->echo_reference = reference;
     pthread_mutex_unlock(&out->lock);
 }
@@ -897,7 +989,7 @@ static void add_echo_reference(struct tuna_stream_out *out,
 static void remove_echo_reference(struct tuna_stream_out *out,
                                   struct echo_reference_itfe *reference)
 {
-    pthread_mutex_lock(&out->lock);
+    lock_output_stream(out);
     if (out->echo_reference == reference) {
         /* stop writing to echo reference */
         reference->write(reference, NULL);
@@ -1081,6 +1173,7 @@ static int do_output_standby(struct tuna_stream_out *out)
 
     if (!out->standby) {
         out->standby = 1;
+        out->running = false;
 
         for (i = 0; i < PCM_TOTAL; i++) {
             if (out->pcm[i]) {
@@ -1098,8 +1191,8 @@ static int do_output_standby(struct tuna_stream_out *out)
         /* if in call, don't turn off the output stage. This will
         be done when the call is ended */
         if (all_outputs_in_standby && adev->mode != AUDIO_MODE_IN_CALL) {
-            set_route_by_array(adev->mixer, hs_output, 0);
-            set_route_by_array(adev->mixer, hf_output, 0);
+            set_route_by_array(adev, ROUTE_HS_OUTPUT, 0);
+            set_route_by_array(adev, ROUTE_HF_OUTPUT, 0);
         }
 
 #ifdef USE_HDMI_AUDIO
@@ -1109,7 +1202,7 @@ static int do_output_standby(struct tuna_stream_out *out)
             if (adev->outputs[OUTPUT_LOW_LATENCY] != NULL &&
                     !adev->outputs[OUTPUT_LOW_LATENCY]->standby) {
                 struct tuna_stream_out *ll_out = adev->outputs[OUTPUT_LOW_LATENCY];
-                pthread_mutex_lock(&ll_out->lock);
+                lock_output_stream(ll_out);
                 do_output_standby(ll_out);
                 pthread_mutex_unlock(&ll_out->lock);
             }
@@ -1131,7 +1224,7 @@ static int out_standby(struct audio_stream *stream)
     int status;
 
     pthread_mutex_lock(&out->dev->lock);
-    pthread_mutex_lock(&out->lock);
+    lock_output_stream(out);
     status = do_output_standby(out);
     pthread_mutex_unlock(&out->lock);
     pthread_mutex_unlock(&out->dev->lock);
@@ -1160,7 +1253,7 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
     if (ret >= 0) {
         val = atoi(value);
         pthread_mutex_lock(&adev->lock);
-        pthread_mutex_lock(&out->lock);
+        lock_output_stream(out);
         if ((adev->out_device != val) && (val != 0)) {
             /* this is needed only when changing device on low latency output
              * as other output streams are not used for voice use cases nor
@@ -1209,7 +1302,7 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
         pthread_mutex_unlock(&out->lock);
         if (force_input_standby) {
             in = adev->active_input;
-            pthread_mutex_lock(&in->lock);
+            lock_input_stream(in);
             do_input_standby(in);
             pthread_mutex_unlock(&in->lock);
         }
@@ -1263,11 +1356,14 @@ static uint32_t out_get_latency_low_latency(const struct audio_stream_out *strea
 {
     struct tuna_stream_out *out = (struct tuna_stream_out *)stream;
 
+    unsigned int period_count = out->use_mmap ? PLAYBACK_MMAP_SHORT_PERIOD_COUNT :
+                                                PLAYBACK_SHORT_PERIOD_COUNT;
+
     /*  Note: we use the default rate here from pcm_config_mm.rate */
 #ifndef USE_VARIABLE_SAMPLING_RATE
-    return (SHORT_PERIOD_SIZE * PLAYBACK_SHORT_PERIOD_COUNT * 1000) / pcm_config_tones.rate;
+    return (SHORT_PERIOD_SIZE * period_count * 1000) / pcm_config_tones.rate;
 #else
-    return (SHORT_PERIOD_SIZE * PLAYBACK_SHORT_PERIOD_COUNT * 1000) / out->sample_rate; // ?
+    return (SHORT_PERIOD_SIZE * period_count * 1000) / out->sample_rate; // ?
 #endif
 }
 
@@ -1312,6 +1408,76 @@ static int out_set_volume_hdmi(struct audio_stream_out *stream, float left,
 }
 #endif
 
+/* must be called with output stream mutex locked.
+ * Samples the hardware pointer of the primary PCM before each low latency write and updates
+ * the statistics reported by out_dump(), in irq mode only if PLAYBACK_STATS_PROPERTY is set.
+ * In mmap no-irq mode nothing wakes us up at period
+ * boundaries and tinyalsa only polls with a millisecond timeout once the buffer is full, so
+ * also sleep here until no more than out->write_threshold frames are left in the buffer.
+ */
+static void throttle_output_low_latency(struct tuna_stream_out *out, size_t frames)
+{
+    struct timespec time_stamp;
+    unsigned int avail;
+    unsigned int latency_us;
+    unsigned int rate;
+    int kernel_frames;
+    int primary_pcm = 0;
+
+    /* in irq mode pcm_write() blocks for us and the timestamp only feeds statistics */
+    if (!out->use_mmap && !out->collect_stats)
+        return;
+
+    /* Find the first active PCM to act as primary */
+    while ((primary_pcm < PCM_TOTAL) && !out->pcm[primary_pcm])
+        primary_pcm++;
+    if (primary_pcm == PCM_TOTAL)
+        return;
+    rate = out->config[primary_pcm].rate;
+
+    if (pcm_get_htimestamp(out->pcm[primary_pcm], &avail, &time_stamp) < 0) {
+        /* not started yet, or stopped by an underrun */
+        if (out->running) {
+            out->underruns++;
+            out->running = false;
+        }
+        return;
+    }
+    kernel_frames = pcm_get_buffer_size(out->pcm[primary_pcm]) - avail;
+    if (out->running && kernel_frames <= 0)
+        out->underruns++;
+    out->running = true;
+
+    while (out->use_mmap && kernel_frames > out->write_threshold) {
+        unsigned long time = (unsigned long)
+                (((int64_t)(kernel_frames - out->write_threshold) * 1000000) / rate);
+        if (time < MIN_MMAP_WRITE_SLEEP_US)
+            time = MIN_MMAP_WRITE_SLEEP_US;
+        usleep(time);
+
+        if (pcm_get_htimestamp(out->pcm[primary_pcm], &avail, &time_stamp) < 0)
+            break;
+        kernel_frames = pcm_get_buffer_size(out->pcm[primary_pcm]) - avail;
+    }
+
+    /* time for the last frame of this write to be rendered */
+    latency_us = (unsigned int)(((int64_t)(kernel_frames + frames) * 1000000) / rate);
+    if (out->latency_count == 0 || latency_us < out->latency_min_us)
+        out->latency_min_us = latency_us;
+    if (latency_us > out->latency_max_us)
+        out->latency_max_us = latency_us;
+    out->latency_sum_us += latency_us;
+    out->latency_count++;
+}
+
+static int out_pcm_write(struct tuna_stream_out *out, struct pcm *pcm, void *data,
+                         unsigned int count)
+{
+    if (out->use_mmap)
+        return pcm_mmap_write(pcm, data, count);
+    return pcm_write(pcm, data, count);
+}
+
 static ssize_t out_write_low_latency(struct audio_stream_out *stream, const void* buffer,
                          size_t bytes)
 {
@@ -1325,25 +1491,26 @@ static ssize_t out_write_low_latency(struct audio_stream_out *stream, const void
     struct tuna_stream_in *in;
     int i;
 
-    /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
-     * on the output stream mutex - e.g. executing select_mode() while holding the hw device
-     * mutex
-     */
-    pthread_mutex_lock(&adev->lock);
-    pthread_mutex_lock(&out->lock);
+    lock_output_stream(out);
     if (out->standby) {
-        ret = start_output_stream_low_latency(out);
-        if (ret != 0) {
-            pthread_mutex_unlock(&adev->lock);
-            goto exit;
+        /* the hw device mutex is only needed to leave standby */
+        pthread_mutex_unlock(&out->lock);
+        pthread_mutex_lock(&adev->lock);
+        lock_output_stream(out);
+        if (out->standby) {
+            ret = start_output_stream_low_latency(out);
+            if (ret != 0) {
+                pthread_mutex_unlock(&adev->lock);
+                goto exit;
+            }
+            out->standby = 0;
+            /* a change in output device may change the microphone selection */
+            if (adev->active_input &&
+                    adev->active_input->source == AUDIO_SOURCE_VOICE_COMMUNICATION)
+                force_input_standby = true;
         }
-        out->standby = 0;
-        /* a change in output device may change the microphone selection */
-        if (adev->active_input &&
-                adev->active_input->source == AUDIO_SOURCE_VOICE_COMMUNICATION)
-            force_input_standby = true;
+        pthread_mutex_unlock(&adev->lock);
     }
-    pthread_mutex_unlock(&adev->lock);
 
 #ifdef OUT_RESAMPLER
     for (i = 0; i < PCM_TOTAL; i++) {
@@ -1360,6 +1527,8 @@ static ssize_t out_write_low_latency(struct audio_stream_out *stream, const void
     }
 #endif
 
+    throttle_output_low_latency(out, out_frames);
+
     if (out->echo_reference != NULL) {
         struct echo_reference_buffer b;
         b.raw = (void *)buffer;
@@ -1376,17 +1545,20 @@ static ssize_t out_write_low_latency(struct audio_stream_out *stream, const void
             if (out->config[i].rate == DEFAULT_OUT_SAMPLING_RATE) {
                 /* PCM uses native sample rate */
 #endif
-                ret = PCM_WRITE(out->pcm[i], (void *)buffer, bytes);
+                ret = out_pcm_write(out, out->pcm[i], (void *)buffer, bytes);
 #ifdef OUT_RESAMPLER
             } else {
                 /* PCM needs resampler */
-                ret = PCM_WRITE(out->pcm[i], (void *)out->buffer, out_frames * frame_size);
+                ret = out_pcm_write(out, out->pcm[i], (void *)out->buffer,
+                                    out_frames * frame_size);
             }
 #endif
             if (ret)
                 break;
         }
     }
+    if (ret == 0)
+        out->written += bytes / frame_size;
 
 exit:
     pthread_mutex_unlock(&out->lock);
@@ -1400,7 +1572,7 @@ exit:
         pthread_mutex_lock(&adev->lock);
         if (adev->active_input) {
             in = adev->active_input;
-            pthread_mutex_lock(&in->lock);
+            lock_input_stream(in);
             do_input_standby(in);
             pthread_mutex_unlock(&in->lock);
         }
@@ -1423,22 +1595,23 @@ static ssize_t out_write_deep_buffer(struct audio_stream_out *stream, const void
     int kernel_frames;
     void *buf;
 
-    /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
-     * on the output stream mutex - e.g. executing select_mode() while holding the hw device
-     * mutex
-     */
-    pthread_mutex_lock(&adev->lock);
-    pthread_mutex_lock(&out->lock);
+    lock_output_stream(out);
     if (out->standby) {
-        ret = start_output_stream_deep_buffer(out);
-        if (ret != 0) {
-            pthread_mutex_unlock(&adev->lock);
-            goto exit;
+        /* the hw device mutex is only needed to leave standby */
+        pthread_mutex_unlock(&out->lock);
+        pthread_mutex_lock(&adev->lock);
+        lock_output_stream(out);
+        if (out->standby) {
+            ret = start_output_stream_deep_buffer(out);
+            if (ret != 0) {
+                pthread_mutex_unlock(&adev->lock);
+                goto exit;
+            }
+            out->standby = 0;
         }
-        out->standby = 0;
+        pthread_mutex_unlock(&adev->lock);
     }
-    use_long_periods = adev->screen_off && !adev->active_input;
-    pthread_mutex_unlock(&adev->lock);
+    use_long_periods = android_atomic_acquire_load(&adev->long_periods) != 0;
 
     if (use_long_periods != out->use_long_periods) {
         if (use_long_periods) {
@@ -1517,21 +1690,22 @@ static ssize_t out_write_hdmi(struct audio_stream_out *stream, const void* buffe
     size_t frame_size = audio_stream_out_frame_size(&out->stream);
     size_t in_frames = bytes / frame_size;
 
-    /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
-     * on the output stream mutex - e.g. executing select_mode() while holding the hw device
-     * mutex
-     */
-    pthread_mutex_lock(&adev->lock);
-    pthread_mutex_lock(&out->lock);
+    lock_output_stream(out);
     if (out->standby) {
-        ret = start_output_stream_hdmi(out);
-        if (ret != 0) {
-            pthread_mutex_unlock(&adev->lock);
-            goto exit;
+        /* the hw device mutex is only needed to leave standby */
+        pthread_mutex_unlock(&out->lock);
+        pthread_mutex_lock(&adev->lock);
+        lock_output_stream(out);
+        if (out->standby) {
+            ret = start_output_stream_hdmi(out);
+            if (ret != 0) {
+                pthread_mutex_unlock(&adev->lock);
+                goto exit;
+            }
+            out->standby = 0;
         }
-        out->standby = 0;
+        pthread_mutex_unlock(&adev->lock);
     }
-    pthread_mutex_unlock(&adev->lock);
 
     if (out->muted)
         memset((void *)buffer, 0, bytes);
@@ -1563,6 +1737,58 @@ static int out_get_render_position(const struct audio_stream_out *stream __unuse
     return -EINVAL;
 }
 
+static int out_get_presentation_position(const struct audio_stream_out *stream,
+                                         uint64_t *frames, struct timespec *timestamp)
+{
+    struct tuna_stream_out *out = (struct tuna_stream_out *)stream;
+    int ret = -1;
+    int i;
+
+    lock_output_stream(out);
+    for (i = 0; i < PCM_TOTAL; i++) {
+        unsigned int avail;
+
+        if (!out->pcm[i])
+            continue;
+        if (pcm_get_htimestamp(out->pcm[i], &avail, timestamp) == 0) {
+            /* kernel frames are counted at the PCM rate, written frames at the stream rate */
+            int64_t kernel_frames = pcm_get_buffer_size(out->pcm[i]) - avail;
+            int64_t signed_frames = out->written - kernel_frames *
+                    out_get_sample_rate(&stream->common) / out->config[i].rate;
+            if (signed_frames >= 0) {
+                *frames = signed_frames;
+                ret = 0;
+            }
+        }
+        break;
+    }
+    pthread_mutex_unlock(&out->lock);
+
+    return ret;
+}
+
+static int out_dump_low_latency(const struct audio_stream *stream, int fd)
+{
+    struct tuna_stream_out *out = (struct tuna_stream_out *)stream;
+
+    lock_output_stream(out);
+    dprintf(fd, "      Low latency output: %s mode, %u ms nominal latency\n",
+            out->use_mmap ? "mmap no-irq" : "irq", out_get_latency_low_latency(&out->stream));
+    if (out->use_mmap || out->collect_stats)
+        dprintf(fd, "        frames written: %llu, underruns: %u\n",
+                (unsigned long long)out->written, out->underruns);
+    else
+        dprintf(fd, "        frames written: %llu (set %s to 1 for statistics)\n",
+                (unsigned long long)out->written, PLAYBACK_STATS_PROPERTY);
+    if (out->latency_count != 0)
+        dprintf(fd, "        queued latency: min %u us, avg %u us, max %u us over %u writes\n",
+                out->latency_min_us, (unsigned int)(out->latency_sum_us / out->latency_count),
+                out->latency_max_us, out->latency_count);
+    pthread_mutex_unlock(&out->lock);
+
+    return 0;
+}
+
 static int out_add_audio_effect(const struct audio_stream *stream __unused, effect_handle_t effect __unused)
 {
     return 0;
@@ -1582,6 +1808,7 @@ static int start_input_stream(struct tuna_stream_in *in)
     struct tuna_audio_device *adev = in->dev;
 
     adev->active_input = in;
+    update_long_periods(adev);
 
     if (adev->mode != AUDIO_MODE_IN_CALL) {
         adev->in_device = in->device;
@@ -1621,14 +1848,15 @@ static int start_input_stream(struct tuna_stream_in *in)
         ALOGE("cannot open pcm_in driver: %s", pcm_get_error(in->pcm));
         pcm_close(in->pcm);
         adev->active_input = NULL;
+        update_long_periods(adev);
         return -ENOMEM;
     }
 
-    /* force read and proc buf reallocation case of frame size or channel count change */
+    /* discard buffered frames in case of frame size or channel count change. The buffers
+     * themselves are sized for CAPTURE_MAX_CHANNELS and need no reallocation. */
     in->read_buf_frames = 0;
-    in->read_buf_size = 0;
     in->proc_buf_frames = 0;
-    in->proc_buf_size = 0;
+    in->proc_buf_offset = 0;
     /* if no supported sample rate is available, use the resampler */
     if (in->resampler) {
         in->resampler->reset(in->resampler);
@@ -1684,6 +1912,7 @@ static int do_input_standby(struct tuna_stream_in *in)
         in->pcm = NULL;
 
         adev->active_input = 0;
+        update_long_periods(adev);
         if (adev->mode != AUDIO_MODE_IN_CALL) {
             adev->in_device = AUDIO_DEVICE_NONE;
             select_input_device(adev);
@@ -1707,7 +1936,7 @@ static int in_standby(struct audio_stream *stream)
     int status;
 
     pthread_mutex_lock(&in->dev->lock);
-    pthread_mutex_lock(&in->lock);
+    lock_input_stream(in);
     status = do_input_standby(in);
     pthread_mutex_unlock(&in->lock);
     pthread_mutex_unlock(&in->dev->lock);
@@ -1734,7 +1963,7 @@ static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_INPUT_SOURCE, value, sizeof(value));
 
     pthread_mutex_lock(&adev->lock);
-    pthread_mutex_lock(&in->lock);
+    lock_input_stream(in);
     if (ret >= 0) {
         val = atoi(value);
         /* no audio source uses val == 0 */
@@ -1827,6 +2056,44 @@ static void get_capture_delay(struct tuna_stream_in *in,
 
 }
 
+/* Capture scratch buffers are allocated by in_alloc_buffers() when the stream is opened and
+ * are sized in frames of CAPTURE_MAX_CHANNELS channels, so a channel count change does not
+ * require reallocating them. They only have to grow if a client reads more frames than
+ * in_get_buffer_size() advertised, which STREAM_BUFFER_ALLOC_CHECK makes fatal. On failure
+ * the buffer and its size are left as they were. */
+static int grow_capture_buffer(int16_t **buf, size_t *size, size_t frames, const char *name)
+{
+#ifdef STREAM_BUFFER_ALLOC_CHECK
+    LOG_ALWAYS_FATAL("grow_capture_buffer(): %s grown from %zu to %zu frames in the read path",
+                     name, *size, frames);
+#endif
+    ALOGW("grow_capture_buffer(): %s grown from %zu to %zu frames", name, *size, frames);
+    if (pcm_grow_buffer(buf, size, frames, CAPTURE_MAX_FRAME_SIZE) != 0) {
+        ALOGE("grow_capture_buffer(): cannot grow %s to %zu frames", name, frames);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static int in_alloc_buffers(struct tuna_stream_in *in)
+{
+    size_t frames = get_input_buffer_size(in->requested_rate, AUDIO_FORMAT_PCM_16_BIT, 1) /
+                        sizeof(int16_t);
+
+    in->read_buf_size = in->config.period_size;
+    in->read_buf = (int16_t *)malloc(in->read_buf_size * CAPTURE_MAX_FRAME_SIZE);
+    in->proc_buf_size = frames;
+    in->proc_buf_in = (int16_t *)malloc(in->proc_buf_size * PROC_BUF_IN_COUNT *
+                                            CAPTURE_MAX_FRAME_SIZE);
+    in->proc_buf_out = (int16_t *)malloc(in->proc_buf_size * CAPTURE_MAX_FRAME_SIZE);
+    in->ref_buf_size = frames;
+    in->ref_buf = (int16_t *)malloc(in->ref_buf_size * CAPTURE_MAX_FRAME_SIZE);
+
+    if (!in->read_buf || !in->proc_buf_in || !in->proc_buf_out || !in->ref_buf)
+        return -ENOMEM;
+    return 0;
+}
+
 static int32_t update_echo_reference(struct tuna_stream_in *in, size_t frames)
 {
     struct echo_reference_buffer b;
@@ -1835,15 +2102,10 @@ static int32_t update_echo_reference(struct tuna_stream_in *in, size_t frames)
     ALOGV("update_echo_reference, frames = [%d], in->ref_buf_frames = [%d],  "
           "b.frame_count = [%d]",
          frames, in->ref_buf_frames, frames - in->ref_buf_frames);
+    if (in->ref_buf_size < frames &&
+            grow_capture_buffer(&in->ref_buf, &in->ref_buf_size, frames, "ref_buf") != 0)
+        frames = in->ref_buf_size;  /* read what fits */
     if (in->ref_buf_frames < frames) {
-        if (in->ref_buf_size < frames) {
-            in->ref_buf_size = frames;
-            in->ref_buf = (int16_t *)realloc(in->ref_buf, pcm_frames_to_bytes(in->pcm, frames));
-            ALOG_ASSERT((in->ref_buf != NULL),
-                        "update_echo_reference() failed to reallocate ref_buf");
-            ALOGV("update_echo_reference(): ref_buf %p extended to %d bytes",
-                      in->ref_buf, pcm_frames_to_bytes(in->pcm, frames));
-        }
         b.frame_count = frames - in->ref_buf_frames;
         b.raw = (void *)(in->ref_buf + in->ref_buf_frames * in->config.channels);
 
@@ -1946,13 +2208,13 @@ static int get_next_buffer(struct resampler_buffer_provider *buffer_provider,
 
     if (in->read_buf_frames == 0) {
         size_t size_in_bytes = pcm_frames_to_bytes(in->pcm, in->config.period_size);
-        if (in->read_buf_size < in->config.period_size) {
-            in->read_buf_size = in->config.period_size;
-            in->read_buf = (int16_t *) realloc(in->read_buf, size_in_bytes);
-            ALOG_ASSERT((in->read_buf != NULL),
-                        "get_next_buffer() failed to reallocate read_buf");
-            ALOGV("get_next_buffer(): read_buf %p extended to %d bytes",
-                  in->read_buf, size_in_bytes);
+        if (in->read_buf_size < in->config.period_size &&
+                grow_capture_buffer(&in->read_buf, &in->read_buf_size,
+                                    in->config.period_size, "read_buf") != 0) {
+            buffer->raw = NULL;
+            buffer->frame_count = 0;
+            in->read_status = -ENOMEM;
+            return -ENOMEM;
         }
 
         in->read_status = pcm_read(in->pcm, (void*)in->read_buf, size_in_bytes);
@@ -2053,24 +2315,31 @@ static ssize_t process_frames(struct tuna_stream_in *in, void* buffer, ssize_t f
             ssize_t frames_rd;
 
             if (in->proc_buf_size < (size_t)frames) {
-                size_t size_in_bytes = pcm_frames_to_bytes(in->pcm, frames);
-
-                in->proc_buf_size = (size_t)frames;
-                in->proc_buf_in = (int16_t *)realloc(in->proc_buf_in, size_in_bytes);
-                ALOG_ASSERT((in->proc_buf_in != NULL),
-                            "process_frames() failed to reallocate proc_buf_in");
-                if (has_aux_channels) {
-                    in->proc_buf_out = (int16_t *)realloc(in->proc_buf_out, size_in_bytes);
-                    ALOG_ASSERT((in->proc_buf_out != NULL),
-                                "process_frames() failed to reallocate proc_buf_out");
-                    proc_buf_out = in->proc_buf_out;
+                size_t size = in->proc_buf_size * PROC_BUF_IN_COUNT;
+
+                /* proc_buf_size only grows once both buffers have */
+                if (grow_capture_buffer(&in->proc_buf_in, &size,
+                                        frames * PROC_BUF_IN_COUNT, "proc_buf_in") != 0 ||
+                        grow_capture_buffer(&in->proc_buf_out, &in->proc_buf_size,
+                                            frames, "proc_buf_out") != 0) {
+                    frames_wr = -ENOMEM;
+                    break;
                 }
-                ALOGV("process_frames(): proc_buf_in %p extended to %d bytes",
-                     in->proc_buf_in, size_in_bytes);
+                if (has_aux_channels)
+                    proc_buf_out = in->proc_buf_out;
+            }
+            /* the frames not yet consumed start at proc_buf_offset: move them back to the
+             * beginning of in->proc_buf_in only if the missing frames do not fit after them */
+            if (in->proc_buf_offset + (size_t)frames > in->proc_buf_size * PROC_BUF_IN_COUNT) {
+                memmove(in->proc_buf_in,
+                        in->proc_buf_in + in->proc_buf_offset * in->config.channels,
+                        in->proc_buf_frames * in->config.channels * sizeof(int16_t));
+                in->proc_buf_offset = 0;
             }
             frames_rd = read_frames(in,
                                     in->proc_buf_in +
-                                        in->proc_buf_frames * in->config.channels,
+                                        (in->proc_buf_offset + in->proc_buf_frames) *
+                                            in->config.channels,
                                     frames - in->proc_buf_frames);
             if (frames_rd < 0) {
                 frames_wr = frames_rd;
@@ -2085,7 +2354,7 @@ static ssize_t process_frames(struct tuna_stream_in *in, void* buffer, ssize_t f
          /* in_buf.frameCount and out_buf.frameCount indicate respectively
           * the maximum number of frames to be consumed and produced by process() */
         in_buf.frameCount = in->proc_buf_frames;
-        in_buf.s16 = in->proc_buf_in;
+        in_buf.s16 = in->proc_buf_in + in->proc_buf_offset * in->config.channels;
         out_buf.frameCount = frames - frames_wr;
         out_buf.s16 = (int16_t *)proc_buf_out + frames_wr * in->config.channels;
 
@@ -2102,14 +2371,12 @@ static ssize_t process_frames(struct tuna_stream_in *in, void* buffer, ssize_t f
 
         /* process() has updated the number of frames consumed and produced in
          * in_buf.frameCount and out_buf.frameCount respectively
-         * move remaining frames to the beginning of in->proc_buf_in */
+         * skip consumed frames, remaining ones are read in place on next iteration */
         in->proc_buf_frames -= in_buf.frameCount;
-
-        if (in->proc_buf_frames) {
-            memcpy(in->proc_buf_in,
-                   in->proc_buf_in + in_buf.frameCount * in->config.channels,
-                   in->proc_buf_frames * in->config.channels * sizeof(int16_t));
-        }
+        if (in->proc_buf_frames)
+            in->proc_buf_offset += in_buf.frameCount;
+        else
+            in->proc_buf_offset = 0;
 
         /* if not enough frames were passed to process(), read more and retry. */
         if (out_buf.frameCount == 0) {
@@ -2130,28 +2397,9 @@ static ssize_t process_frames(struct tuna_stream_in *in, void* buffer, ssize_t f
     /* Remove aux_channels that have been added on top of main_channels
      * Assumption is made that the channels are interleaved and that the main
      * channels are first. */
-    if (has_aux_channels)
-    {
-        size_t src_channels = in->config.channels;
-        size_t dst_channels = popcount(in->main_channels);
-        int16_t* src_buffer = (int16_t *)proc_buf_out;
-        int16_t* dst_buffer = (int16_t *)buffer;
-
-        if (dst_channels == 1) {
-            for (i = frames_wr; i > 0; i--)
-            {
-                *dst_buffer++ = *src_buffer;
-                src_buffer += src_channels;
-            }
-        } else {
-            for (i = frames_wr; i > 0; i--)
-            {
-                memcpy(dst_buffer, src_buffer, dst_channels*sizeof(int16_t));
-                dst_buffer += dst_channels;
-                src_buffer += src_channels;
-            }
-        }
-    }
+    if (has_aux_channels && frames_wr > 0)
+        pcm_extract_channels_s16((int16_t *)buffer, (int16_t *)proc_buf_out, frames_wr,
+                                 in->config.channels, popcount(in->main_channels));
 
     return frames_wr;
 }
@@ -2164,18 +2412,19 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
     struct tuna_audio_device *adev = in->dev;
     size_t frames_rq = bytes / audio_stream_in_frame_size(stream);
 
-    /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
-     * on the input stream mutex - e.g. executing select_mode() while holding the hw device
-     * mutex
-     */
-    pthread_mutex_lock(&adev->lock);
-    pthread_mutex_lock(&in->lock);
+    lock_input_stream(in);
     if (in->standby) {
-        ret = start_input_stream(in);
-        if (ret == 0)
-            in->standby = 0;
+        /* the hw device mutex is only needed to leave standby */
+        pthread_mutex_unlock(&in->lock);
+        pthread_mutex_lock(&adev->lock);
+        lock_input_stream(in);
+        if (in->standby) {
+            ret = start_input_stream(in);
+            if (ret == 0)
+                in->standby = 0;
+        }
+        pthread_mutex_unlock(&adev->lock);
     }
-    pthread_mutex_unlock(&adev->lock);
 
     if (ret < 0)
         goto exit;
@@ -2493,7 +2742,7 @@ static int in_add_audio_effect(const struct audio_stream *stream,
     effect_descriptor_t desc;
 
     pthread_mutex_lock(&in->dev->lock);
-    pthread_mutex_lock(&in->lock);
+    lock_input_stream(in);
     if (in->num_preprocessors >= MAX_PREPROCESSORS) {
         status = -ENOSYS;
         goto exit;
@@ -2537,7 +2786,7 @@ static int in_remove_audio_effect(const struct audio_stream *stream,
     effect_descriptor_t desc;
 
     pthread_mutex_lock(&in->dev->lock);
-    pthread_mutex_lock(&in->lock);
+    lock_input_stream(in);
     if (in->num_preprocessors <= 0) {
         status = -ENOSYS;
         goto exit;
@@ -2628,6 +2877,7 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
 {
     struct tuna_audio_device *ladev = (struct tuna_audio_device *)dev;
     struct tuna_stream_out *out;
+    char value[PROPERTY_VALUE_MAX];
     int ret;
     int output_type;
 
@@ -2707,6 +2957,18 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         out->stream.get_latency = out_get_latency_low_latency;
         out->stream.write = out_write_low_latency;
         out->stream.set_volume = out_set_volume;
+        out->stream.get_presentation_position = out_get_presentation_position;
+
+#ifdef PLAYBACK_MMAP
+        property_get(PLAYBACK_MMAP_PROPERTY, value, "1");
+#else
+        property_get(PLAYBACK_MMAP_PROPERTY, value, "0");
+#endif
+        out->use_mmap = (atoi(value) != 0);
+        property_get(PLAYBACK_STATS_PROPERTY, value, "0");
+        out->collect_stats = (atoi(value) != 0);
+        ALOGV("adev_open_output_stream() low latency %s mode",
+              out->use_mmap ? "mmap no-irq" : "irq");
     }
 
 #ifdef OUT_RESAMPLER
@@ -2725,13 +2987,32 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->stream.common.get_format = out_get_format;
     out->stream.common.set_format = out_set_format;
     out->stream.common.standby = out_standby;
-    out->stream.common.dump = out_dump;
+    if (output_type == OUTPUT_LOW_LATENCY)
+        out->stream.common.dump = out_dump_low_latency;
+    else
+        out->stream.common.dump = out_dump;
     out->stream.common.set_parameters = out_set_parameters;
     out->stream.common.get_parameters = out_get_parameters;
     out->stream.common.add_audio_effect = out_add_audio_effect;
     out->stream.common.remove_audio_effect = out_remove_audio_effect;
     out->stream.get_render_position = out_get_render_position;
 
+#ifdef OUT_RESAMPLER
+    /* allocated here rather than when leaving standby so that out_write() never allocates */
+    if (output_type == OUTPUT_LOW_LATENCY)
+        out->buffer_frames = pcm_config_tones.period_size * 2;
+    else if (output_type == OUTPUT_DEEP_BUF)
+        out->buffer_frames = DEEP_BUFFER_SHORT_PERIOD_SIZE * 2;
+    if (out->buffer_frames != 0) {
+        out->buffer = malloc(out->buffer_frames * audio_stream_out_frame_size(&out->stream));
+        if (!out->buffer) {
+            release_resampler(out->resampler);
+            ret = -ENOMEM;
+            goto err_open;
+        }
+    }
+#endif
+
     out->dev = ladev;
     out->standby = 1;
     /* out->muted = false; by calloc() */
@@ -2824,10 +3105,13 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
 
     ret = str_parms_get_str(parms, "screen_state", value, sizeof(value));
     if (ret >= 0) {
+        pthread_mutex_lock(&adev->lock);
         if (strcmp(value, AUDIO_PARAMETER_VALUE_ON) == 0)
             adev->screen_off = false;
         else
             adev->screen_off = true;
+        update_long_periods(adev);
+        pthread_mutex_unlock(&adev->lock);
     }
 
     str_parms_destroy(parms);
@@ -2898,12 +3182,12 @@ static int adev_set_mic_mute(struct audio_hw_device *dev, bool state)
          * Instead we must go over the RIL's head and change the mixer volume.
          * select_output_device also uses this same method to mute the in-call
          * mic, albeit temporarily, as well. */
-        unsigned int channel;
         int volume = (state ? 0 : MIXER_ABE_GAIN_0DB);
-        for (channel = 0; channel < 2; channel++)
-            mixer_ctl_set_value(adev->mixer_ctls.voice_ul_volume,
-                                channel, volume);
-         }
+
+        pthread_mutex_lock(&adev->lock);
+        set_mixer_value(adev->mixer_ctls.voice_ul_volume, 2, volume);
+        pthread_mutex_unlock(&adev->lock);
+    }
 
     return 0;
 }
@@ -2993,6 +3277,10 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
         }
     }
 
+    ret = in_alloc_buffers(in);
+    if (ret != 0)
+        goto err;
+
     in->dev = ladev;
     in->standby = 1;
     in->device = devices & ~AUDIO_DEVICE_BIT_IN;
@@ -3004,6 +3292,10 @@ err:
     if (in->resampler)
         release_resampler(in->resampler);
 
+    free(in->read_buf);
+    free(in->proc_buf_in);
+    free(in->proc_buf_out);
+    free(in->ref_buf);
     free(in);
     return ret;
 }
@@ -3056,6 +3348,7 @@ static int adev_open(const hw_module_t* module, const char* name,
                      hw_device_t** device)
 {
     struct tuna_audio_device *adev;
+    unsigned int i;
     int ret;
 
     if (strcmp(name, AUDIO_HARDWARE_INTERFACE) != 0)
@@ -3092,53 +3385,53 @@ static int adev_open(const hw_module_t* module, const char* name,
         return -EINVAL;
     }
 
-    adev->mixer_ctls.dl1_eq = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.dl1_eq = get_mixer_shadow(adev,
                                            MIXER_DL1_EQUALIZER);
-    adev->mixer_ctls.mm_dl1_volume = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.mm_dl1_volume = get_mixer_shadow(adev,
                                            MIXER_DL1_MEDIA_PLAYBACK_VOLUME);
-    adev->mixer_ctls.tones_dl1_volume = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.tones_dl1_volume = get_mixer_shadow(adev,
                                            MIXER_DL1_TONES_PLAYBACK_VOLUME);
-    adev->mixer_ctls.mm_dl2_volume = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.mm_dl2_volume = get_mixer_shadow(adev,
                                            MIXER_DL2_MEDIA_PLAYBACK_VOLUME);
-    adev->mixer_ctls.vx_dl2_volume = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.vx_dl2_volume = get_mixer_shadow(adev,
                                            MIXER_DL2_VOICE_PLAYBACK_VOLUME);
-    adev->mixer_ctls.tones_dl2_volume = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.tones_dl2_volume = get_mixer_shadow(adev,
                                            MIXER_DL2_TONES_PLAYBACK_VOLUME);
-    adev->mixer_ctls.mm_dl1 = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.mm_dl1 = get_mixer_shadow(adev,
                                            MIXER_DL1_MIXER_MULTIMEDIA);
-    adev->mixer_ctls.vx_dl1 = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.vx_dl1 = get_mixer_shadow(adev,
                                            MIXER_DL1_MIXER_VOICE);
-    adev->mixer_ctls.tones_dl1 = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.tones_dl1 = get_mixer_shadow(adev,
                                            MIXER_DL1_MIXER_TONES);
-    adev->mixer_ctls.mm_dl2 = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.mm_dl2 = get_mixer_shadow(adev,
                                            MIXER_DL2_MIXER_MULTIMEDIA);
-    adev->mixer_ctls.vx_dl2 = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.vx_dl2 = get_mixer_shadow(adev,
                                            MIXER_DL2_MIXER_VOICE);
-    adev->mixer_ctls.tones_dl2 = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.tones_dl2 = get_mixer_shadow(adev,
                                            MIXER_DL2_MIXER_TONES);
-    adev->mixer_ctls.dl2_mono = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.dl2_mono = get_mixer_shadow(adev,
                                            MIXER_DL2_MONO_MIXER);
-    adev->mixer_ctls.dl1_headset = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.dl1_headset = get_mixer_shadow(adev,
                                            MIXER_DL1_PDM_SWITCH);
-    adev->mixer_ctls.dl1_bt = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.dl1_bt = get_mixer_shadow(adev,
                                            MIXER_DL1_BT_VX_SWITCH);
-    adev->mixer_ctls.earpiece_enable = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.earpiece_enable = get_mixer_shadow(adev,
                                            MIXER_EARPHONE_ENABLE_SWITCH);
-    adev->mixer_ctls.left_capture = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.left_capture = get_mixer_shadow(adev,
                                            MIXER_ANALOG_LEFT_CAPTURE_ROUTE);
-    adev->mixer_ctls.right_capture = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.right_capture = get_mixer_shadow(adev,
                                            MIXER_ANALOG_RIGHT_CAPTURE_ROUTE);
-    adev->mixer_ctls.amic_ul_volume = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.amic_ul_volume = get_mixer_shadow(adev,
                                            MIXER_AMIC_UL_VOLUME);
-    adev->mixer_ctls.voice_ul_volume = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.voice_ul_volume = get_mixer_shadow(adev,
                                            MIXER_AUDUL_VOICE_UL_VOLUME);
-    adev->mixer_ctls.sidetone_capture = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.sidetone_capture = get_mixer_shadow(adev,
                                            MIXER_SIDETONE_MIXER_CAPTURE);
-    adev->mixer_ctls.headset_volume = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.headset_volume = get_mixer_shadow(adev,
                                            MIXER_HEADSET_PLAYBACK_VOLUME);
-    adev->mixer_ctls.speaker_volume = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.speaker_volume = get_mixer_shadow(adev,
                                            MIXER_HANDSFREE_PLAYBACK_VOLUME);
-    adev->mixer_ctls.earpiece_volume = mixer_get_ctl_by_name(adev->mixer,
+    adev->mixer_ctls.earpiece_volume = get_mixer_shadow(adev,
                                            MIXER_EARPHONE_PLAYBACK_VOLUME);
 
     if (!adev->mixer_ctls.dl1_eq ||
@@ -3171,9 +3464,12 @@ static int adev_open(const hw_module_t* module, const char* name,
         return -EINVAL;
     }
 
+    for (i = 0; i < ROUTE_TOTAL; i++)
+        resolve_route_by_array(adev, i);
+
     /* Set the default route before the PCM stream is opened */
     pthread_mutex_lock(&adev->lock);
-    set_route_by_array(adev->mixer, defaults, 1);
+    set_route_by_array(adev, ROUTE_DEFAULTS, 1);
     adev->mode = AUDIO_MODE_NORMAL;
     adev->out_device = AUDIO_DEVICE_OUT_SPEAKER;
     adev->in_device = AUDIO_DEVICE_IN_BUILTIN_MIC & ~AUDIO_DEVICE_BIT_IN;
@@ -121,8 +121,21 @@
 #endif
 
 /* User serviceable */
-/* #define to use mmap no-irq mode for playback, #undef for non-mmap irq mode */
+/* #define to use mmap no-irq mode for low latency playback by default, #undef for non-mmap
+ * irq mode. The mode is chosen when the stream is opened and PLAYBACK_MMAP_PROPERTY overrides
+ * this default.
+ */
 #undef PLAYBACK_MMAP        // was #define
+#define PLAYBACK_MMAP_PROPERTY "persist.audio.tuna.ll_mmap"
+/* #define to abort when a capture scratch buffer has to grow in the read path, whatever
+ * the log level. They are allocated when the stream is opened, so this only fires if a
+ * client reads more than in_get_buffer_size() advertised.
+ */
+#undef STREAM_BUFFER_ALLOC_CHECK
+/* set to 1 to collect low latency playback statistics in irq mode too. They cost an
+ * extra ioctl per write, which mmap no-irq mode needs anyway for pacing.
+ */
+#define PLAYBACK_STATS_PROPERTY "debug.audio.tuna.ll_stats"
 /* short period (aka low latency) in milliseconds */
 #define SHORT_PERIOD_MS 3   // was 22
 /* deep buffer short period (screen on) in milliseconds */
@@ -191,14 +204,6 @@
 #endif
 
 
-/* write function */
-#ifdef PLAYBACK_MMAP
-#define PCM_WRITE pcm_mmap_write
-#else
-#define PCM_WRITE pcm_write
-#endif
-
-
 /* User serviceable */
 #define CAPTURE_PERIOD_MS 22
 
@@ -216,8 +221,17 @@
 #define CAPTURE_PERIOD_SIZE (ABE_BASE_FRAME_COUNT * CAPTURE_PERIOD_MS * MULTIPLIER_FACTOR)
 /* number of periods for capture */
 #define CAPTURE_PERIOD_COUNT 2
+/* maximum number of channels read from the ABE: main channels plus the auxiliary
+ * channels requested by pre processing (see in_aux_cnl_configs) */
+#define CAPTURE_MAX_CHANNELS 4
+#define CAPTURE_MAX_FRAME_SIZE (CAPTURE_MAX_CHANNELS * sizeof(int16_t))
+/* pre processing input buffer size in number of input buffers. Frames not yet consumed by
+ * the effects are only moved back to the start of the buffer when it wraps. */
+#define PROC_BUF_IN_COUNT 4
 /* minimum sleep time in out_write() when write threshold is not reached */
 #define MIN_WRITE_SLEEP_US 5000
+/* minimum sleep time in out_write_low_latency() in mmap no-irq mode */
+#define MIN_MMAP_WRITE_SLEEP_US 500
 
 
 #ifdef FORCE_OUT_SAMPLING_RATE
@@ -251,26 +265,26 @@
 #define VX_WB_SAMPLING_RATE 16000
 
 
-/* Number of pseudo periods for low latency playback.
- * These are called "pseudo" periods in that they are not known as periods by ALSA.
- * Formerly, ALSA was configured in MMAP mode with 2 large periods, and this
- * number was set to 4 (2 didn't work).
- * The short periods size and count were only known by the audio HAL.
- * Now for low latency, we are using non-MMAP mode and can set this to 2.
+/* Number of pseudo periods for low latency playback in mmap no-irq mode.
+ * These are called "pseudo" periods in that they are not known as periods by ALSA:
+ * no interrupt is raised at period boundaries and the HAL paces its writes from the
+ * hardware pointer so that no more than PLAYBACK_MMAP_WRITE_THRES frames are queued
+ * when a new buffer is written. 2 didn't work.
  */
-#ifdef PLAYBACK_MMAP
-#define PLAYBACK_SHORT_PERIOD_COUNT 4
-/* If sample rate converter is required, then use triple-buffering to
+#define PLAYBACK_MMAP_SHORT_PERIOD_COUNT 4
+#define PLAYBACK_MMAP_WRITE_THRES (SHORT_PERIOD_SIZE * (PLAYBACK_MMAP_SHORT_PERIOD_COUNT - 2))
+
+/* Number of periods for low latency playback in non-MMAP irq mode.
+ * If sample rate converter is required, then use triple-buffering to
  * help mask the variance in cycle times.  Otherwise use double-buffering.
  */
 /* TODO: Figure out a better check for this
-#elif DEFAULT_OUT_SAMPLING_RATE != MM_FULL_POWER_SAMPLING_RATE
+#if DEFAULT_OUT_SAMPLING_RATE != MM_FULL_POWER_SAMPLING_RATE
 #define PLAYBACK_SHORT_PERIOD_COUNT 3
 #define OUT_RESAMPLER
+#endif
 */
-#else
 #define PLAYBACK_SHORT_PERIOD_COUNT 2
-#endif
 
 
 /* conversions from dB to ABE and codec gains */
@@ -333,6 +347,25 @@ enum output_type {
     OUTPUT_TOTAL
 };
 
+/* The route arrays, see all_routes[] */
+enum route_id {
+    ROUTE_DEFAULTS,
+    ROUTE_HF_OUTPUT,
+    ROUTE_HS_OUTPUT,
+    ROUTE_MM_UL2_BT,
+    ROUTE_MM_UL2_AMIC_LEFT,
+    ROUTE_MM_UL2_AMIC_RIGHT,
+    ROUTE_MM_UL2_AMIC_DUAL_MAIN_SUB,
+    ROUTE_MM_UL2_AMIC_DUAL_SUB_MAIN,
+    ROUTE_VX_UL_AMIC_LEFT,
+    ROUTE_VX_UL_AMIC_RIGHT,
+    ROUTE_VX_UL_BT,
+    ROUTE_TOTAL
+};
+
+/* maximum number of controls in one route array */
+#define MAX_ROUTE_SETTINGS 20
+
 enum pcm_type {
     PCM_NORMAL = 0,
     PCM_SPDIF,
@@ -349,32 +382,50 @@ enum tty_modes {
     TTY_MODE_FULL
 };
 
+/* Last values written to a mixer control. The routes and mixer_ctls share one shadow
+ * per control, so that writing the value a control already has is skipped.
+ * Controls with more than MIXER_SHADOW_MAX_VALUES values are always written.
+ */
+#define MIXER_SHADOW_MAX_VALUES 2
+
+struct mixer_shadow
+{
+    struct mixer_ctl *ctl;
+    unsigned int num_values;
+    bool valid[MIXER_SHADOW_MAX_VALUES];    /* intval[i], or strval for value 0, is current */
+    int intval[MIXER_SHADOW_MAX_VALUES];
+    const char *strval;
+};
+
+/* maximum number of distinct mixer controls used by all_routes[] and mixer_ctls */
+#define MAX_MIXER_SHADOWS 64
+
 struct mixer_ctls
 {
-    struct mixer_ctl *dl1_eq;
-    struct mixer_ctl *mm_dl1_volume;
-    struct mixer_ctl *tones_dl1_volume;
-    struct mixer_ctl *mm_dl2_volume;
-    struct mixer_ctl *vx_dl2_volume;
-    struct mixer_ctl *tones_dl2_volume;
-    struct mixer_ctl *mm_dl1;
-    struct mixer_ctl *mm_dl2;
-    struct mixer_ctl *vx_dl1;
-    struct mixer_ctl *vx_dl2;
-    struct mixer_ctl *tones_dl1;
-    struct mixer_ctl *tones_dl2;
-    struct mixer_ctl *earpiece_enable;
-    struct mixer_ctl *dl2_mono;
-    struct mixer_ctl *dl1_headset;
-    struct mixer_ctl *dl1_bt;
-    struct mixer_ctl *left_capture;
-    struct mixer_ctl *right_capture;
-    struct mixer_ctl *amic_ul_volume;
-    struct mixer_ctl *voice_ul_volume;
-    struct mixer_ctl *sidetone_capture;
-    struct mixer_ctl *headset_volume;
-    struct mixer_ctl *speaker_volume;
-    struct mixer_ctl *earpiece_volume;
+    struct mixer_shadow *dl1_eq;
+    struct mixer_shadow *mm_dl1_volume;
+    struct mixer_shadow *tones_dl1_volume;
+    struct mixer_shadow *mm_dl2_volume;
+    struct mixer_shadow *vx_dl2_volume;
+    struct mixer_shadow *tones_dl2_volume;
+    struct mixer_shadow *mm_dl1;
+    struct mixer_shadow *mm_dl2;
+    struct mixer_shadow *vx_dl1;
+    struct mixer_shadow *vx_dl2;
+    struct mixer_shadow *tones_dl1;
+    struct mixer_shadow *tones_dl2;
+    struct mixer_shadow *earpiece_enable;
+    struct mixer_shadow *dl2_mono;
+    struct mixer_shadow *dl1_headset;
+    struct mixer_shadow *dl1_bt;
+    struct mixer_shadow *left_capture;
+    struct mixer_shadow *right_capture;
+    struct mixer_shadow *amic_ul_volume;
+    struct mixer_shadow *voice_ul_volume;
+    struct mixer_shadow *sidetone_capture;
+    struct mixer_shadow *headset_volume;
+    struct mixer_shadow *speaker_volume;
+    struct mixer_shadow *earpiece_volume;
 };
 
 #define MAX_PREPROCESSORS 3 /* maximum one AGC + one NS + one AEC per input stream */
@@ -395,6 +446,7 @@ struct tuna_stream_in {
     struct audio_stream_in stream;
 
     pthread_mutex_t lock;       /* see note below on mutex acquisition order */
+    pthread_mutex_t pre_lock;   /* acquired before lock, see lock_input_stream() */
     struct pcm_config config;
     struct pcm *pcm;
     int device;
@@ -414,6 +466,7 @@ struct tuna_stream_in {
     int16_t *proc_buf_out;
     size_t proc_buf_size;
     size_t proc_buf_frames;
+    size_t proc_buf_offset;
 
     int16_t *ref_buf;
     size_t ref_buf_size;
@@ -434,6 +487,7 @@ struct tuna_stream_out {
     struct audio_stream_out stream;
 
     pthread_mutex_t lock;       /* see note below on mutex acquisition order */
+    pthread_mutex_t pre_lock;   /* acquired before lock, see lock_output_stream() */
     struct pcm_config config[PCM_TOTAL];
     struct pcm *pcm[PCM_TOTAL];
 #ifdef OUT_RESAMPLER
@@ -445,6 +499,16 @@ struct tuna_stream_out {
     struct echo_reference_itfe *echo_reference;
     int write_threshold;
     bool use_long_periods;
+    bool use_mmap;              /* low latency: mmap no-irq mode, chosen at open */
+    bool collect_stats;         /* low latency: statistics also in irq mode */
+    bool running;               /* hardware pointer seen moving since last start */
+    uint64_t written;           /* frames written since the stream was opened */
+    /* low latency playback statistics, reported by out_dump() */
+    unsigned int underruns;
+    unsigned int latency_min_us;
+    unsigned int latency_max_us;
+    uint64_t latency_sum_us;
+    unsigned int latency_count;
     audio_channel_mask_t channel_mask;
     audio_channel_mask_t sup_channel_masks[3];
 
@@ -468,6 +532,10 @@ struct tuna_audio_device {
     pthread_mutex_t lock;       /* see note below on mutex acquisition order */
     struct mixer *mixer;
     struct mixer_ctls mixer_ctls;
+    struct mixer_shadow mixer_shadows[MAX_MIXER_SHADOWS];
+    unsigned int num_mixer_shadows;
+    /* shadow of each control of each route array, resolved when the device is opened */
+    struct mixer_shadow *route_shadows[ROUTE_TOTAL][MAX_ROUTE_SETTINGS];
     audio_mode_t mode;
     int out_device;
     int in_device;
@@ -483,6 +551,7 @@ struct tuna_audio_device {
     bool bluetooth_nrec;
     int wb_amr;
     bool screen_off;
+    volatile int32_t long_periods;  /* screen_off && !active_input, see update_long_periods() */
 
     /* RIL */
     struct ril_handle ril;
@@ -497,7 +566,7 @@ struct route_setting
 };
 
 /* These are values that never change */
-struct route_setting defaults[] = {
+const struct route_setting defaults[] = {
     /* general */
     {
         .ctl_name = MIXER_DL2_LEFT_EQUALIZER,
@@ -576,7 +645,7 @@ struct route_setting defaults[] = {
     },
 };
 
-struct route_setting hf_output[] = {
+const struct route_setting hf_output[] = {
     {
         .ctl_name = MIXER_HF_LEFT_PLAYBACK,
         .strval = MIXER_PLAYBACK_HF_DAC,
@@ -590,7 +659,7 @@ struct route_setting hf_output[] = {
     },
 };
 
-struct route_setting hs_output[] = {
+const struct route_setting hs_output[] = {
     {
         .ctl_name = MIXER_HS_LEFT_PLAYBACK,
         .strval = MIXER_PLAYBACK_HS_DAC,
@@ -605,7 +674,7 @@ struct route_setting hs_output[] = {
 };
 
 /* MM UL front-end paths */
-struct route_setting mm_ul2_bt[] = {
+const struct route_setting mm_ul2_bt[] = {
     {
         .ctl_name = MIXER_MUX_UL10,
         .strval = MIXER_BT_LEFT,
@@ -619,7 +688,7 @@ struct route_setting mm_ul2_bt[] = {
     },
 };
 
-struct route_setting mm_ul2_amic_left[] = {
+const struct route_setting mm_ul2_amic_left[] = {
     {
         .ctl_name = MIXER_MUX_UL10,
         .strval = MIXER_AMIC0,
@@ -633,7 +702,7 @@ struct route_setting mm_ul2_amic_left[] = {
     },
 };
 
-struct route_setting mm_ul2_amic_right[] = {
+const struct route_setting mm_ul2_amic_right[] = {
     {
         .ctl_name = MIXER_MUX_UL10,
         .strval = MIXER_AMIC1,
@@ -649,7 +718,7 @@ struct route_setting mm_ul2_amic_right[] = {
 
 /* dual mic configuration with main mic on main channel and sub mic on aux channel.
  * Used for handset mode (near talk)  */
-struct route_setting mm_ul2_amic_dual_main_sub[] = {
+const struct route_setting mm_ul2_amic_dual_main_sub[] = {
     {
         .ctl_name = MIXER_MUX_UL10,
         .strval = MIXER_AMIC0,
@@ -665,7 +734,7 @@ struct route_setting mm_ul2_amic_dual_main_sub[] = {
 
 /* dual mic configuration with sub mic on main channel and main mic on aux channel.
  * Used for speakerphone mode (far talk)  */
-struct route_setting mm_ul2_amic_dual_sub_main[] = {
+const struct route_setting mm_ul2_amic_dual_sub_main[] = {
     {
         .ctl_name = MIXER_MUX_UL10,
         .strval = MIXER_AMIC1,
@@ -680,7 +749,7 @@ struct route_setting mm_ul2_amic_dual_sub_main[] = {
 };
 
 /* VX UL front-end paths */
-struct route_setting vx_ul_amic_left[] = {
+const struct route_setting vx_ul_amic_left[] = {
     {
         .ctl_name = MIXER_MUX_VX0,
         .strval = MIXER_AMIC0,
@@ -698,7 +767,7 @@ struct route_setting vx_ul_amic_left[] = {
     },
 };
 
-struct route_setting vx_ul_amic_right[] = {
+const struct route_setting vx_ul_amic_right[] = {
     {
         .ctl_name = MIXER_MUX_VX0,
         .strval = MIXER_AMIC1,
@@ -716,7 +785,7 @@ struct route_setting vx_ul_amic_right[] = {
     },
 };
 
-struct route_setting vx_ul_bt[] = {
+const struct route_setting vx_ul_bt[] = {
     {
         .ctl_name = MIXER_MUX_VX0,
         .strval = MIXER_BT_LEFT,
@@ -734,6 +803,21 @@ struct route_setting vx_ul_bt[] = {
     },
 };
 
+/* Every route array, indexed by route_id */
+const struct route_setting *const all_routes[ROUTE_TOTAL] = {
+    [ROUTE_DEFAULTS] = defaults,
+    [ROUTE_HF_OUTPUT] = hf_output,
+    [ROUTE_HS_OUTPUT] = hs_output,
+    [ROUTE_MM_UL2_BT] = mm_ul2_bt,
+    [ROUTE_MM_UL2_AMIC_LEFT] = mm_ul2_amic_left,
+    [ROUTE_MM_UL2_AMIC_RIGHT] = mm_ul2_amic_right,
+    [ROUTE_MM_UL2_AMIC_DUAL_MAIN_SUB] = mm_ul2_amic_dual_main_sub,
+    [ROUTE_MM_UL2_AMIC_DUAL_SUB_MAIN] = mm_ul2_amic_dual_sub_main,
+    [ROUTE_VX_UL_AMIC_LEFT] = vx_ul_amic_left,
+    [ROUTE_VX_UL_AMIC_RIGHT] = vx_ul_amic_right,
+    [ROUTE_VX_UL_BT] = vx_ul_bt,
+};
+
 
 #define STRING_TO_ENUM(string) { #string, string }
 
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PCM_UTILS_NEON
+#endif
+
+#include "pcm_utils.h"
+
+/* number of frames handled per iteration by the NEON loops */
+#define NEON_FRAMES 8
+
+#ifdef PCM_UTILS_NEON
+/* Returns the number of frames processed, the remainder is left to the scalar loop.
+ * Each iteration loads NEON_FRAMES frames before storing fewer samples, so dst == src
+ * is safe.
+ */
+static size_t extract_channels_neon(int16_t *dst, const int16_t *src, size_t frames,
+                                    unsigned int src_channels, unsigned int dst_channels)
+{
+    size_t done = frames - frames % NEON_FRAMES;
+    size_t i;
+
+    switch ((src_channels << 4) | dst_channels) {
+    case 0x21:
+        for (i = 0; i < done; i += NEON_FRAMES) {
+            int16x8x2_t in = vld2q_s16(src);
+            vst1q_s16(dst, in.val[0]);
+            src += NEON_FRAMES * 2;
+            dst += NEON_FRAMES;
+        }
+        break;
+    case 0x31:
+        for (i = 0; i < done; i += NEON_FRAMES) {
+            int16x8x3_t in = vld3q_s16(src);
+            vst1q_s16(dst, in.val[0]);
+            src += NEON_FRAMES * 3;
+            dst += NEON_FRAMES;
+        }
+        break;
+    case 0x32:
+        for (i = 0; i < done; i += NEON_FRAMES) {
+            int16x8x3_t in = vld3q_s16(src);
+            int16x8x2_t out = { { in.val[0], in.val[1] } };
+            vst2q_s16(dst, out);
+            src += NEON_FRAMES * 3;
+            dst += NEON_FRAMES * 2;
+        }
+        break;
+    case 0x41:
+        for (i = 0; i < done; i += NEON_FRAMES) {
+            int16x8x4_t in = vld4q_s16(src);
+            vst1q_s16(dst, in.val[0]);
+            src += NEON_FRAMES * 4;
+            dst += NEON_FRAMES;
+        }
+        break;
+    case 0x42:
+        for (i = 0; i < done; i += NEON_FRAMES) {
+            int16x8x4_t in = vld4q_s16(src);
+            int16x8x2_t out = { { in.val[0], in.val[1] } };
+            vst2q_s16(dst, out);
+            src += NEON_FRAMES * 4;
+            dst += NEON_FRAMES * 2;
+        }
+        break;
+    default:
+        done = 0;
+        break;
+    }
+
+    return done;
+}
+#endif
+
+void pcm_extract_channels_s16(int16_t *dst, const int16_t *src, size_t frames,
+                              unsigned int src_channels, unsigned int dst_channels)
+{
+    size_t i;
+
+    if (dst_channels == src_channels) {
+        if (dst != src)
+            memcpy(dst, src, frames * src_channels * sizeof(int16_t));
+        return;
+    }
+
+#ifdef PCM_UTILS_NEON
+    i = extract_channels_neon(dst, src, frames, src_channels, dst_channels);
+    src += i * src_channels;
+    dst += i * dst_channels;
+    frames -= i;
+#endif
+
+    if (dst_channels == 1) {
+        for (i = 0; i < frames; i++) {
+            *dst++ = *src;
+            src += src_channels;
+        }
+    } else {
+        for (i = 0; i < frames; i++) {
+            unsigned int ch;
+
+            for (ch = 0; ch < dst_channels; ch++)
+                dst[ch] = src[ch];
+            dst += dst_channels;
+            src += src_channels;
+        }
+    }
+}
+
+int pcm_grow_buffer(int16_t **buf, size_t *frames, size_t new_frames, size_t frame_size)
+{
+    int16_t *grown;
+
+    if (frame_size && new_frames > SIZE_MAX / frame_size)
+        return -ENOMEM;
+    grown = (int16_t *)realloc(*buf, new_frames * frame_size);
+    if (!grown)
+        return -ENOMEM;
+    *buf = grown;
+    *frames = new_frames;
+    return 0;
+}
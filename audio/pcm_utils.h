@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TUNA_PCM_UTILS_H
+#define TUNA_PCM_UTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+/* Copies the first dst_channels channels of each frame of the interleaved 16 bit
+ * buffer src, which has src_channels channels per frame, to dst.
+ * dst_channels must not be greater than src_channels.
+ * dst may be the same buffer as src, but the buffers must not overlap otherwise.
+ * Uses NEON for the channel counts found on the capture path when available.
+ */
+void pcm_extract_channels_s16(int16_t *dst, const int16_t *src, size_t frames,
+                              unsigned int src_channels, unsigned int dst_channels);
+
+/* Grows the buffer *buf of *frames frames of frame_size bytes to hold new_frames frames,
+ * keeping its contents. Returns 0, or -ENOMEM with *buf and *frames left as they were.
+ */
+int pcm_grow_buffer(int16_t **buf, size_t *frames, size_t new_frames, size_t frame_size);
+
+__END_DECLS
+
+#endif
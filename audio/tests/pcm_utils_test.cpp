@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "pcm_utils.h"
+
+/*
+ * Checks pcm_extract_channels_s16() against a plain per-sample loop. Built
+ * for the target, this covers the NEON kernels and the scalar loop that
+ * finishes their tail; built for the host, the scalar path alone.
+ */
+
+#define MAX_CHANNELS 4
+#define MAX_FRAMES 67   // odd, and not a multiple of the NEON block
+
+static void extract_reference(int16_t *dst, const int16_t *src, size_t frames,
+                              unsigned int src_channels, unsigned int dst_channels)
+{
+    for (size_t i = 0; i < frames; i++)
+        for (unsigned int ch = 0; ch < dst_channels; ch++)
+            dst[i * dst_channels + ch] = src[i * src_channels + ch];
+}
+
+// every sample differs, and the sign bit is exercised
+static void fill(int16_t *buf, size_t frames, unsigned int channels)
+{
+    for (size_t i = 0; i < frames * channels; i++)
+        buf[i] = (int16_t)(i * 257 + 0x8000);
+}
+
+class PcmExtractTest : public ::testing::TestWithParam<int> {
+protected:
+    unsigned int srcChannels() const { return GetParam() >> 4; }
+    unsigned int dstChannels() const { return GetParam() & 0xf; }
+};
+
+TEST_P(PcmExtractTest, MatchesReference) {
+    const unsigned int src_channels = srcChannels();
+    const unsigned int dst_channels = dstChannels();
+    int16_t src[MAX_FRAMES * MAX_CHANNELS];
+    int16_t dst[MAX_FRAMES * MAX_CHANNELS + 1];
+    int16_t expected[MAX_FRAMES * MAX_CHANNELS];
+
+    fill(src, MAX_FRAMES, src_channels);
+    for (size_t frames = 0; frames <= MAX_FRAMES; frames++) {
+        SCOPED_TRACE(frames);
+        const size_t samples = frames * dst_channels;
+        memset(dst, 0x5a, sizeof(dst));
+        extract_reference(expected, src, frames, src_channels, dst_channels);
+        pcm_extract_channels_s16(dst, src, frames, src_channels, dst_channels);
+        for (size_t i = 0; i < samples; i++) {
+            ASSERT_EQ(expected[i], dst[i])
+                    << "frame " << i / dst_channels << " channel " << i % dst_channels;
+        }
+        // nothing written past the last frame
+        ASSERT_EQ(0x5a5a, (uint16_t)dst[samples]);
+    }
+}
+
+TEST_P(PcmExtractTest, InPlace) {
+    const unsigned int src_channels = srcChannels();
+    const unsigned int dst_channels = dstChannels();
+    int16_t buf[MAX_FRAMES * MAX_CHANNELS];
+    int16_t src[MAX_FRAMES * MAX_CHANNELS];
+    int16_t expected[MAX_FRAMES * MAX_CHANNELS];
+
+    fill(src, MAX_FRAMES, src_channels);
+    for (size_t frames = 0; frames <= MAX_FRAMES; frames++) {
+        SCOPED_TRACE(frames);
+        memcpy(buf, src, sizeof(buf));
+        extract_reference(expected, src, frames, src_channels, dst_channels);
+        pcm_extract_channels_s16(buf, buf, frames, src_channels, dst_channels);
+        ASSERT_EQ(0, memcmp(expected, buf, frames * dst_channels * sizeof(int16_t)));
+    }
+}
+
+// src_channels << 4 | dst_channels
+INSTANTIATE_TEST_CASE_P(AllChannelCounts, PcmExtractTest,
+        ::testing::Values(0x11, 0x21, 0x22, 0x31, 0x32, 0x33,
+                          0x41, 0x42, 0x43, 0x44));
+
+TEST(PcmGrowBufferTest, KeepsContents) {
+    const size_t frame_size = 4 * sizeof(int16_t);
+    size_t frames = 16;
+    int16_t *buf = (int16_t *)malloc(frames * frame_size);
+    ASSERT_TRUE(buf != NULL);
+    fill(buf, frames, 4);
+
+    ASSERT_EQ(0, pcm_grow_buffer(&buf, &frames, 1024, frame_size));
+    ASSERT_EQ(1024u, frames);
+    int16_t expected[16 * 4];
+    fill(expected, 16, 4);
+    EXPECT_EQ(0, memcmp(expected, buf, sizeof(expected)));
+    free(buf);
+}
+
+TEST(PcmGrowBufferTest, FailureLeavesBufferAlone) {
+    const size_t frame_size = 4 * sizeof(int16_t);
+    size_t frames = 16;
+    int16_t *buf = (int16_t *)malloc(frames * frame_size);
+    ASSERT_TRUE(buf != NULL);
+    int16_t *old = buf;
+
+    // overflows the byte count
+    EXPECT_EQ(-ENOMEM, pcm_grow_buffer(&buf, &frames, SIZE_MAX / frame_size + 1, frame_size));
+    EXPECT_EQ(old, buf);
+    EXPECT_EQ(16u, frames);
+    // too large for realloc()
+    EXPECT_EQ(-ENOMEM, pcm_grow_buffer(&buf, &frames, SIZE_MAX / frame_size, frame_size));
+    EXPECT_EQ(old, buf);
+    EXPECT_EQ(16u, frames);
+    free(buf);
+}
@@ -40,6 +40,7 @@ void dumpstate_board()
     dump_file("tiler 2x1 map", "/d/tiler/map/2x1");
     dump_file("wlan", "/sys/module/bcmdhd/parameters/info_string");
     dump_file("bluetooth", "/d/bt");
+    dump_file("sensors hal", "/data/system/sensors.tuna.txt");
     dump_file("mmc0 name", "/sys/devices/platform/omap/omap_hsmmc.0/mmc_host/mmc0/mmc0:0001/name");
     dump_file("mmc0 cid", "/sys/devices/platform/omap/omap_hsmmc.0/mmc_host/mmc0/mmc0:0001/cid");
     dump_file("mmc0 csd", "/sys/devices/platform/omap/omap_hsmmc.0/mmc_host/mmc0/mmc0:0001/csd");
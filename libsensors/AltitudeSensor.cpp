@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "AltitudeSensor.h"
+#include "PressureSensor.h"
+
+/* Fed with the raw BMP180 pressure by the pressure sensor. */
+AltitudeSensor::AltitudeSensor(SamsungSensorBase *pressure)
+    : SamsungSensorBase(NULL, NULL, ABS_PRESSURE,
+                        SAMSUNG_SENSOR_FIFO_SIZE),
+      mSeaLevel(ALTITUDE_SEA_LEVEL_DEFAULT),
+      mLastAltitude(0)
+{
+    mPendingEvent.sensor = ID_ALT;
+    mPendingEvent.type = SENSOR_TYPE_TUNA_ALTITUDE;
+    attachTo(pressure);
+}
+
+bool AltitudeSensor::handleEvent(input_event const *event,
+                                 sensors_event_t *data) {
+    if (!mHaveLastValue) {
+        // first sample since enabling, pick up the current reference
+        char value[PROPERTY_VALUE_MAX];
+        property_get(ALTITUDE_SEA_LEVEL_PROPERTY, value, "0");
+        float seaLevel = strtof(value, NULL);
+        mSeaLevel = seaLevel > 0 ? seaLevel : ALTITUDE_SEA_LEVEL_DEFAULT;
+    }
+
+    // the same formula as SensorManager.getAltitude()
+    float pressure = event->value * PRESSURE_HECTO;
+    float altitude = 44330.0f *
+            (1.0f - powf(pressure / mSeaLevel, 1.0f / 5.255f));
+    if (mHaveLastValue && fabsf(altitude - mLastAltitude) < ALTITUDE_DEADBAND)
+        return false;
+    mLastAltitude = altitude;
+    data->data[0] = altitude;
+    return true;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_ALTITUDE_SENSOR_H
+#define ANDROID_ALTITUDE_SENSOR_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "sensors.h"
+#include "SamsungSensorBase.h"
+#include "InputEventReader.h"
+
+/*****************************************************************************/
+
+#define ALTITUDE_SEA_LEVEL_PROPERTY "persist.sensors.sea_level_hpa"
+#define ALTITUDE_SEA_LEVEL_DEFAULT  1013.25f
+
+/* smallest change in metres worth reporting, about 6Pa */
+#define ALTITUDE_DEADBAND 0.5f
+
+struct input_event;
+
+class AltitudeSensor:public SamsungSensorBase {
+    float mSeaLevel;
+    float mLastAltitude;
+
+    virtual bool handleEvent(input_event const * event,
+                             sensors_event_t *data);
+public:
+    AltitudeSensor(SamsungSensorBase *pressure);
+};
+
+/*****************************************************************************/
+
+#endif  /* ANDROID_ALTITUDE_SENSOR_H */
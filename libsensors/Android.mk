@@ -29,13 +29,64 @@ LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\"
 LOCAL_C_INCLUDES += hardware/invensense/60xx/libsensors
 LOCAL_SRC_FILES := \
 	sensors.cpp \
+	AltitudeSensor.cpp \
 	InputEventReader.cpp \
 	LightSensor.cpp \
 	ProximitySensor.cpp \
 	PressureSensor.cpp \
+	PressureTendencySensor.cpp \
 	SamsungSensorBase.cpp \
+	SensorControlQueue.cpp \
+	SensorWorker.cpp \
 	TemperatureSensor.cpp
 
-LOCAL_SHARED_LIBRARIES := libinvensense_hal liblog libcutils libutils libdl
+LOCAL_SHARED_LIBRARIES := libinvensense_hal liblog libcutils libutils libdl libhardware_legacy
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Host test for InputEventCircularReader: events split at arbitrary byte
+# offsets and across the ring wrap must come back whole and in order.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := sensors.tuna_input_reader_test
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := \
+	InputEventReader.cpp \
+	tests/InputEventReader_test.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+
+LOCAL_SHARED_LIBRARIES := liblog
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+# Host test running the Samsung drivers against a fake input device: events
+# replayed through a pipe, control nodes in a fake sysfs directory.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := sensors.tuna_replay_test
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" \
+	-DSAMSUNG_SENSOR_SYSFS_ROOT=\"/tmp/sensors.tuna_test/\"
+LOCAL_C_INCLUDES += $(LOCAL_PATH) $(LOCAL_PATH)/tests \
+	hardware/invensense/60xx/libsensors
+LOCAL_SRC_FILES := \
+	../../../../hardware/invensense/60xx/libsensors/SensorBase.cpp \
+	AltitudeSensor.cpp \
+	InputEventReader.cpp \
+	LightSensor.cpp \
+	PressureSensor.cpp \
+	PressureTendencySensor.cpp \
+	SamsungSensorBase.cpp \
+	SensorControlQueue.cpp \
+	TemperatureSensor.cpp \
+	tests/FakeInputDevice.cpp \
+	tests/SensorReplay_test.cpp
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+
+include $(BUILD_HOST_NATIVE_TEST)
@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <poll.h>
+#include <sys/uio.h>
 
 #include <sys/cdefs.h>
 #include <sys/types.h>
@@ -43,7 +44,8 @@ InputEventCircularReader::InputEventCircularReader(size_t numEvents)
       mHead(mBuffer),
       mCurr(mBuffer),
       mEvents(numEvents),
-      mFreeSpace(numEvents)
+      mFreeSpace(numEvents),
+      mPartialBytes(0)
 {
 }
 
@@ -52,6 +54,10 @@ InputEventCircularReader::~InputEventCircularReader()
     delete [] mBuffer;
 }
 
+/* Reads as many events as fit. evdev only hands out whole events, but other
+ * sources (a pipe replaying a capture, say) can split one across reads; the
+ * bytes of a split event stay in the slot at mHead until the rest arrives.
+ * That slot never wraps, since the first iovec ends on a slot boundary. */
 ssize_t InputEventCircularReader::fill(int fd)
 {
     size_t numEventsRead = 0;
@@ -62,8 +68,8 @@ ssize_t InputEventCircularReader::fill(int fd)
         const size_t numSecond = mFreeSpace - numFirst;
 
         int iovcnt = 1;
-        iov[0].iov_base = mHead;
-        iov[0].iov_len = numFirst * sizeof(input_event);
+        iov[0].iov_base = (char*)mHead + mPartialBytes;
+        iov[0].iov_len = numFirst * sizeof(input_event) - mPartialBytes;
 
         if (numSecond > 0)
         {
@@ -73,12 +79,12 @@ ssize_t InputEventCircularReader::fill(int fd)
         }
 
         const ssize_t nread = readv(fd, iov, iovcnt);
-        if (nread < 0 || nread % sizeof(input_event)) {
-            // we got a partial event!!
-            return nread < 0 ? -errno : -EINVAL;
-        }
+        if (nread < 0)
+            return -errno;
 
-        numEventsRead = nread / sizeof(input_event);
+        const size_t nbytes = mPartialBytes + nread;
+        numEventsRead = nbytes / sizeof(input_event);
+        mPartialBytes = nbytes % sizeof(input_event);
         if (numEventsRead) {
             mHead += numEventsRead;
             mFreeSpace -= numEventsRead;
@@ -34,6 +34,7 @@ class InputEventCircularReader
     struct input_event* mCurr;
     size_t mEvents;
     size_t mFreeSpace;
+    size_t mPartialBytes;   // start of an event already read into mHead
 
 public:
     InputEventCircularReader(size_t numEvents);
@@ -27,21 +27,36 @@
 #include "LightSensor.h"
 
 LightSensor::LightSensor()
-    : SamsungSensorBase(NULL, "lightsensor-level", ABS_MISC)
+    : SamsungSensorBase(NULL, "lightsensor-level", ABS_MISC,
+                        SAMSUNG_SENSOR_FIFO_SIZE)
 {
     mPendingEvent.sensor = ID_L;
     mPendingEvent.type = SENSOR_TYPE_LIGHT;
+    // ignore single count ADC jitter
+    mChangeThreshold = 1;
+    for (int i = 0; i <= LIGHT_ADC_MAX; i++) {
+        mLuxTable[i] = adcToLux(i);
+    }
 }
 
-bool LightSensor::handleEvent(input_event const *event) {
-    if (event->value == -1) {
-        return false;
-    }
+float LightSensor::adcToLux(int value) {
     // Convert adc value to lux assuming:
     // I = 10 * log(Ev) uA
     // R = 24kOhm
     // Max adc value 1023 = 1.25V
     // 1/4 of light reaches sensor
-    mPendingEvent.light = powf(10, event->value * (125.0f / 1023.0f / 24.0f)) * 4;
+    return powf(10, value * (125.0f / 1023.0f / 24.0f)) * 4;
+}
+
+bool LightSensor::handleEvent(input_event const *event,
+                              sensors_event_t *data) {
+    if (event->value == -1) {
+        return false;
+    }
+    if (event->value >= 0 && event->value <= LIGHT_ADC_MAX) {
+        data->light = mLuxTable[event->value];
+    } else {
+        data->light = adcToLux(event->value);
+    }
     return true;
 }
@@ -28,11 +28,17 @@
 
 /*****************************************************************************/
 
+/* the GP2A reports a 10-bit ADC value */
+#define LIGHT_ADC_MAX 1023
+
 struct input_event;
 
 class LightSensor:public SamsungSensorBase {
+    float mLuxTable[LIGHT_ADC_MAX + 1];
 
-    virtual bool handleEvent(input_event const * event);
+    static float adcToLux(int value);
+    virtual bool handleEvent(input_event const * event,
+                             sensors_event_t *data);
 public:
     LightSensor();
 };
@@ -26,20 +26,17 @@
 
 #include "PressureSensor.h"
 
-/*
- * The BMP driver gives pascal values.
- * It needs to be changed into hectoPascal
- */
-#define PRESSURE_HECTO (1.0f/100.0f)
-
 PressureSensor::PressureSensor()
-    : SamsungSensorBase(NULL, "barometer", ABS_PRESSURE)
+    : SamsungSensorBase(NULL, "barometer", ABS_PRESSURE,
+                        SAMSUNG_SENSOR_FIFO_SIZE)
 {
     mPendingEvent.sensor = ID_PR;
     mPendingEvent.type = SENSOR_TYPE_PRESSURE;
+    mSmoothTimestamps = true;
 }
 
-bool PressureSensor::handleEvent(input_event const *event) {
-    mPendingEvent.pressure = event->value * PRESSURE_HECTO;
+bool PressureSensor::handleEvent(input_event const *event,
+                                 sensors_event_t *data) {
+    data->pressure = event->value * PRESSURE_HECTO;
     return true;
 }
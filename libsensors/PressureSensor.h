@@ -28,10 +28,17 @@
 
 /*****************************************************************************/
 
+/*
+ * The BMP driver gives pascal values.
+ * It needs to be changed into hectoPascal
+ */
+#define PRESSURE_HECTO (1.0f/100.0f)
+
 struct input_event;
 
 class PressureSensor:public SamsungSensorBase {
-    virtual bool handleEvent(input_event const * event);
+    virtual bool handleEvent(input_event const * event,
+                             sensors_event_t *data);
 
 public:
     PressureSensor();
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <cutils/log.h>
+
+#include "PressureTendencySensor.h"
+#include "PressureSensor.h"
+
+/* Fed with the raw BMP180 pressure by the pressure sensor. */
+PressureTendencySensor::PressureTendencySensor(SamsungSensorBase *pressure)
+    : SamsungSensorBase(NULL, NULL, ABS_PRESSURE),
+      mHistoryHead(0),
+      mHistoryCount(0),
+      mBucketStart(0),
+      mBucketSum(0),
+      mBucketSamples(0),
+      mLastSample(0),
+      mLastTendency(0)
+{
+    mPendingEvent.sensor = ID_PT;
+    mPendingEvent.type = SENSOR_TYPE_TUNA_PRESSURE_TENDENCY;
+    attachTo(pressure);
+}
+
+/* Each sample goes into the running minute; closing a minute pushes its
+ * average into the ring and compares it with the oldest one, so a sample
+ * costs the same however long the history is. Minutes follow the sample
+ * timestamps, so batched or late samples land where they were taken. */
+bool PressureTendencySensor::handleEvent(input_event const *event,
+                                         sensors_event_t *data) {
+    const int64_t now = eventTimestamp(event);
+    if (!mLastSample || now - mLastSample > TENDENCY_MAX_GAP_NS) {
+        mHistoryHead = 0;
+        mHistoryCount = 0;
+        mBucketStart = now;
+        mBucketSum = 0;
+        mBucketSamples = 0;
+    }
+    mLastSample = now;
+    mBucketSum += event->value;
+    mBucketSamples++;
+    if (now - mBucketStart < TENDENCY_BUCKET_NS)
+        return false;
+
+    float average = mBucketSum * PRESSURE_HECTO / mBucketSamples;
+    if (mHistoryCount == TENDENCY_BUCKETS) {
+        mHistoryHead = (mHistoryHead + 1) % TENDENCY_BUCKETS;
+        mHistoryCount--;
+    }
+    mHistory[(mHistoryHead + mHistoryCount) % TENDENCY_BUCKETS] = average;
+    mHistoryCount++;
+    mBucketStart = now;
+    mBucketSum = 0;
+    mBucketSamples = 0;
+    if (mHistoryCount < 2)
+        return false;
+
+    // until three hours have been seen, this covers what we have
+    float tendency = average - mHistory[mHistoryHead];
+    if (mHaveLastValue && fabsf(tendency - mLastTendency) < TENDENCY_DEADBAND)
+        return false;
+    mLastTendency = tendency;
+    data->data[0] = tendency;
+    return true;
+}
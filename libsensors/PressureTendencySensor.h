@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_PRESSURE_TENDENCY_SENSOR_H
+#define ANDROID_PRESSURE_TENDENCY_SENSOR_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "sensors.h"
+#include "SamsungSensorBase.h"
+#include "InputEventReader.h"
+
+/*****************************************************************************/
+
+/* Pressure is averaged per minute, and three hours of averages are kept. */
+#define TENDENCY_BUCKET_NS  (60LL * 1000000000LL)
+#define TENDENCY_BUCKETS    (3 * 60 + 1)
+
+/* A gap this long between samples makes the history useless. */
+#define TENDENCY_MAX_GAP_NS (5 * TENDENCY_BUCKET_NS)
+
+/* smallest change in hPa worth reporting */
+#define TENDENCY_DEADBAND   0.1f
+
+struct input_event;
+
+class PressureTendencySensor:public SamsungSensorBase {
+    float mHistory[TENDENCY_BUCKETS];
+    int mHistoryHead;
+    int mHistoryCount;
+    int64_t mBucketStart;
+    int64_t mBucketSum;
+    int mBucketSamples;
+    int64_t mLastSample;
+    float mLastTendency;
+
+    virtual bool handleEvent(input_event const * event,
+                             sensors_event_t *data);
+public:
+    PressureTendencySensor(SamsungSensorBase *pressure);
+};
+
+/*****************************************************************************/
+
+#endif  /* ANDROID_PRESSURE_TENDENCY_SENSOR_H */
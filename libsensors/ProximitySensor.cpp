@@ -34,6 +34,7 @@ ProximitySensor::ProximitySensor()
 {
     mPendingEvent.sensor = ID_P;
     mPendingEvent.type = SENSOR_TYPE_PROXIMITY;
+    mChangeThreshold = 0;
 }
 
 int ProximitySensor::setDelay(int32_t handle, int64_t ns)
@@ -46,25 +47,20 @@ float ProximitySensor::indexToValue(size_t index) const
     return index * PROXIMITY_THRESHOLD_GP2A;
 }
 
-bool ProximitySensor::hasPendingEvents() const {
-    return mHasPendingEvent;
-}
-
 int ProximitySensor::handleEnable(int en) {
     if (!en)
         return 0;
 
     struct input_absinfo absinfo;
     if (!ioctl(data_fd, EVIOCGABS(ABS_DISTANCE), &absinfo)) {
-        mHasPendingEvent = true;
-        mPendingEvent.distance = indexToValue(absinfo.value);
-        return 0;
+        return postPendingEvent(indexToValue(absinfo.value), absinfo.value);
     } else {
         return -1;
     }
 }
 
-bool ProximitySensor::handleEvent(input_event const *event) {
-    mPendingEvent.distance = indexToValue(event->value);
+bool ProximitySensor::handleEvent(input_event const *event,
+                                  sensors_event_t *data) {
+    data->distance = indexToValue(event->value);
     return true;
 }
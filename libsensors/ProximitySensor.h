@@ -37,13 +37,13 @@ struct input_event;
 class ProximitySensor:public SamsungSensorBase {
 
     virtual int handleEnable(int en);
-    virtual bool handleEvent(input_event const * event);
+    virtual bool handleEvent(input_event const * event,
+                             sensors_event_t *data);
 
     float indexToValue(size_t index) const;
 public:
     ProximitySensor();
     virtual int setDelay(int32_t handle, int64_t ns);
-    virtual bool hasPendingEvents() const;
 };
 
 /*****************************************************************************/
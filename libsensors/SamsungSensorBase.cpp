@@ -24,20 +24,22 @@
 #include <sys/select.h>
 #include <cutils/log.h>
 #include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
 
 #include "SamsungSensorBase.h"
 
 char *SamsungSensorBase::makeSysfsName(const char *input_name,
                                        const char *file_name) {
     char *name;
-    int length = strlen("/sys/class/input/") +
+    int length = strlen(SAMSUNG_SENSOR_SYSFS_ROOT) +
         strlen(input_name) +
         strlen("/device/") +
         strlen(file_name);
 
     name = new char[length + 1];
     if (name) {
-        strcpy(name, "/sys/class/input/");
+        strcpy(name, SAMSUNG_SENSOR_SYSFS_ROOT);
         strcat(name, input_name);
         strcat(name, "/device/");
         strcat(name, file_name);
@@ -46,7 +48,33 @@ char *SamsungSensorBase::makeSysfsName(const char *input_name,
     return name;
 }
 
-bool SamsungSensorBase::handleEvent(input_event const * event) {
+/* Writes buf to a sysfs node through a descriptor kept open for the life of
+ * the sensor. The node is reopened once if the write fails. Called with
+ * mLock held. */
+int SamsungSensorBase::writeSysfs(int *fd, const char *name,
+                                  const char *buf, size_t len)
+{
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (*fd < 0) {
+            mControlSyscalls++;
+            *fd = open(name, O_RDWR);
+            if (*fd < 0)
+                return -1;
+        }
+        mControlSyscalls++;
+        ssize_t n = pwrite(*fd, buf, len, 0);
+        if (n >= 0)
+            return n;
+        ALOGE("%s: write to %s failed (%s)", __func__, name, strerror(errno));
+        mControlSyscalls++;
+        close(*fd);
+        *fd = -1;
+    }
+    return -1;
+}
+
+bool SamsungSensorBase::handleEvent(input_event const * event,
+                                    sensors_event_t *data) {
     return true;
 }
 
@@ -56,123 +84,556 @@ int SamsungSensorBase::handleEnable(int en) {
 
 SamsungSensorBase::SamsungSensorBase(const char *dev_name,
                                      const char *data_name,
-                                     int sensor_code)
+                                     int sensor_code,
+                                     size_t fifo_size,
+                                     size_t input_events)
     : SensorBase(dev_name, data_name),
       mEnabled(true),
+      mInputSysfsEnable(NULL),
+      mInputSysfsPollDelay(NULL),
+      mInputSysfsEnableFd(-1),
+      mInputSysfsPollDelayFd(-1),
+      mControlSyscalls(0),
+      mLock(PTHREAD_MUTEX_INITIALIZER),
+      mOwner(NULL),
+      mNumSiblings(0),
+      mSiblingsEnabled(0),
+      mActive(false),
       mHasPendingEvent(false),
-      mInputReader(4),
+      mPendingRawValue(0),
+      mInputReader(input_events),
       mSensorCode(sensor_code),
-      mLock(PTHREAD_MUTEX_INITIALIZER)
+      mForwardingReport(false),
+      mForwardBlocked(false),
+      mForwardHead(0),
+      mForwardCount(0),
+      mChangeThreshold(-1),
+      mHaveLastValue(false),
+      mLastValue(0),
+      mDroppedEvents(0),
+      mMonotonicEvents(false),
+      mClockOffset(0),
+      mSmoothTimestamps(false),
+      mLastRawTimestamp(0),
+      mLastTimestamp(0),
+      mPeriodEstimate(0),
+      mJitterEstimate(0),
+      mFifo(NULL),
+      mFifoSize(fifo_size),
+      mFifoHead(0),
+      mFifoCount(0),
+      mFifoDeadline(-1),
+      mBatchTimeout(0),
+      mFlushPending(0)
 {
     mPendingEvent.version = sizeof(sensors_event_t);
     memset(mPendingEvent.data, 0, sizeof(mPendingEvent.data));
-    if (!data_fd)
+    if (data_fd < 0)
         return;
+    setupInput();
+}
+
+/* Finds the sysfs control nodes of the input device behind data_fd and
+ * leaves the hardware disabled. */
+int SamsungSensorBase::setupInput()
+{
     mInputSysfsEnable = makeSysfsName(input_name, "enable");
     if (!mInputSysfsEnable) {
         ALOGE("%s: unable to allocate mem for %s:enable", __func__,
              data_name);
-        return;
+        return -ENOMEM;
     }
     mInputSysfsPollDelay = makeSysfsName(input_name, "poll_delay");
     if (!mInputSysfsPollDelay) {
         ALOGE("%s: unable to allocate mem for %s:poll_delay", __func__,
              data_name);
-        return;
+        return -ENOMEM;
     }
 
     int flags = fcntl(data_fd, F_GETFL, 0);
     fcntl(data_fd, F_SETFL, flags | O_NONBLOCK);
 
-    enable(0, 0);
+#ifdef EVIOCSCLOCKID
+    int clockId = CLOCK_MONOTONIC;
+    mMonotonicEvents = !ioctl(data_fd, EVIOCSCLOCKID, &clockId);
+#endif
+    ALOGW_IF(!mMonotonicEvents,
+             "%s: evdev timestamps are realtime, converting", data_name);
+
+    return enable(0, 0);
+}
+
+/* Reads events from fd instead of the evdev node looked up by name, with
+ * the control nodes of inputName under SAMSUNG_SENSOR_SYSFS_ROOT. Lets a
+ * test backend replay recorded input events into a driver whose device
+ * was not found. Takes ownership of fd. */
+int SamsungSensorBase::useInput(int fd, const char *inputName)
+{
+    if (mOwner || data_fd >= 0)
+        return -EBUSY;
+    data_fd = fd;
+    strncpy(input_name, inputName, sizeof(input_name) - 1);
+    input_name[sizeof(input_name) - 1] = 0;
+    return setupInput();
 }
 
 SamsungSensorBase::~SamsungSensorBase() {
+    while (mNumSiblings) {
+        // siblings cannot reach the hardware once we are gone
+        SamsungSensorBase *sibling = mSiblings[mNumSiblings - 1];
+        sibling->enable(0, 0);
+        sibling->detach();
+    }
     if (mEnabled) {
         enable(0, 0);
     }
+    if (mOwner)
+        detach();
+    if (mInputSysfsEnableFd >= 0)
+        close(mInputSysfsEnableFd);
+    if (mInputSysfsPollDelayFd >= 0)
+        close(mInputSysfsPollDelayFd);
     delete[] mInputSysfsEnable;
     delete[] mInputSysfsPollDelay;
+    delete[] mFifo;
+}
+
+/* Makes this sensor read its reports from owner's input device instead of
+ * opening its own. Both must be constructed, and neither enabled, yet. */
+int SamsungSensorBase::attachTo(SamsungSensorBase *owner)
+{
+    if (owner->mNumSiblings == SAMSUNG_SENSOR_MAX_SIBLINGS)
+        return -ENOSPC;
+    mOwner = owner;
+    mEnabled = false;
+    mMonotonicEvents = owner->mMonotonicEvents;
+    owner->mSiblings[owner->mNumSiblings++] = this;
+    return 0;
+}
+
+void SamsungSensorBase::detach()
+{
+    SamsungSensorBase *owner = mOwner;
+    for (int i = 0; i < owner->mNumSiblings; i++) {
+        if (owner->mSiblings[i] == this) {
+            owner->mSiblings[i] = owner->mSiblings[--owner->mNumSiblings];
+            break;
+        }
+    }
+    mOwner = NULL;
 }
 
 int SamsungSensorBase::enable(int32_t handle, int en)
 {
     int err = 0;
+    SamsungSensorBase *dev = mOwner ? mOwner : this;
     pthread_mutex_lock(&mLock);
+    if (mOwner)
+        pthread_mutex_lock(&mOwner->mLock);
     if (en != mEnabled) {
-        int fd;
-        fd = open(mInputSysfsEnable, O_RDWR);
-        if (fd >= 0) {
-            err = write(fd, en ? "1" : "0", 2);
-            close(fd);
-            if (err < 0) {
-                goto cleanup;
-            }
+        // a shared device is left on while another sensor needs it
+        bool othersEnabled = mOwner ?
+                mOwner->mEnabled || mOwner->mSiblingsEnabled > mEnabled :
+                mSiblingsEnabled > 0;
+        if (!othersEnabled)
+            err = dev->writeSysfs(&dev->mInputSysfsEnableFd,
+                                  dev->mInputSysfsEnable,
+                                  en ? "1" : "0", 2);
+        if (err >= 0 && !mControl.post(SENSOR_CONTROL_ENABLE, en)) {
+            // the poll thread would never hear of it, undo the hardware change
+            ALOGE("%s: control queue full, %sable dropped", __func__,
+                  en ? "en" : "dis");
+            if (!othersEnabled)
+                dev->writeSysfs(&dev->mInputSysfsEnableFd,
+                                dev->mInputSysfsEnable,
+                                en ? "0" : "1", 2);
+            err = -EBUSY;
+        } else if (err >= 0) {
+            if (mOwner)
+                mOwner->mSiblingsEnabled += en ? 1 : -1;
             mEnabled = en;
             err = handleEnable(en);
-        } else {
-            err = -1;
         }
     }
-cleanup:
+    if (mOwner)
+        pthread_mutex_unlock(&mOwner->mLock);
     pthread_mutex_unlock(&mLock);
     return err;
 }
 
 int SamsungSensorBase::setDelay(int32_t handle, int64_t ns)
 {
-    int fd;
+    if (mOwner)
+        return mOwner->setDelay(handle, ns);
+
     int result = 0;
     char buf[21];
     pthread_mutex_lock(&mLock);
-    fd = open(mInputSysfsPollDelay, O_RDWR);
-    if (fd < 0) {
-        result = -1;
-        goto done;
-    }
     sprintf(buf, "%lld", ns);
-    write(fd, buf, strlen(buf)+1);
-    close(fd);
-done:
+    if (writeSysfs(&mInputSysfsPollDelayFd, mInputSysfsPollDelay,
+                   buf, strlen(buf)+1) < 0)
+        result = -1;
     pthread_mutex_unlock(&mLock);
     return result;
 }
 
+int SamsungSensorBase::batch(int32_t handle, int flags, int64_t period_ns,
+                             int64_t timeout)
+{
+    if (timeout > 0 && !mFifoSize)
+        return -EINVAL;
+    if (flags & SENSORS_BATCH_DRY_RUN)
+        return 0;
+
+    int err = 0;
+    pthread_mutex_lock(&mLock);
+    if (timeout > 0 && !mFifo) {
+        // published to the poll thread by the message below
+        mFifo = new sensors_event_t[mFifoSize];
+    }
+    if (!mControl.post(SENSOR_CONTROL_BATCH, timeout))
+        err = -EBUSY;
+    pthread_mutex_unlock(&mLock);
+    return err;
+}
+
+int SamsungSensorBase::flush(int32_t handle)
+{
+    int err = 0;
+    pthread_mutex_lock(&mLock);
+    if (!mEnabled)
+        err = -EINVAL;      // nothing would ever complete it
+    else if (!mControl.post(SENSOR_CONTROL_FLUSH))
+        err = -EBUSY;
+    pthread_mutex_unlock(&mLock);
+    return err;
+}
+
+/* Called from handleEnable() to report a reading without waiting for the
+ * driver, e.g. the current proximity state. rawValue is the input value it
+ * was converted from, for on-change filtering. */
+int SamsungSensorBase::postPendingEvent(float value, int rawValue)
+{
+    return mControl.post(SENSOR_CONTROL_EVENT, rawValue, value) ? 0 : -EBUSY;
+}
+
+/* Applies control-plane changes on the poll thread. */
+void SamsungSensorBase::processControl()
+{
+    sensor_control_t msg;
+    while (mControl.get(&msg)) {
+        switch (msg.what) {
+        case SENSOR_CONTROL_ENABLE:
+            mActive = msg.arg;
+            // the first sample after enabling is always reported
+            mHaveLastValue = false;
+            mLastRawTimestamp = 0;
+            mLastTimestamp = 0;
+            mPeriodEstimate = 0;
+            if (!mActive) {
+                // batched samples are not reported once disabled
+                mFifoCount = 0;
+                mFifoDeadline = -1;
+                mHasPendingEvent = false;
+            }
+            break;
+        case SENSOR_CONTROL_BATCH:
+            mBatchTimeout = msg.arg;
+            if (mFifoCount) {
+                // report the queued samples against the new latency
+                mFifoDeadline = getTimestamp() + mBatchTimeout;
+            }
+            break;
+        case SENSOR_CONTROL_FLUSH:
+            mFlushPending++;
+            break;
+        case SENSOR_CONTROL_EVENT:
+            mPendingEvent.data[0] = msg.value;
+            mPendingRawValue = msg.arg;
+            mHasPendingEvent = true;
+            break;
+        }
+    }
+}
+
+bool SamsungSensorBase::hasPendingEvents() const
+{
+    return !mControl.isEmpty() || mHasPendingEvent || mFlushPending ||
+           mForwardCount || mForwardBlocked ||
+           (mFifoCount && isFifoReady(getTimestamp()));
+}
+
+void SamsungSensorBase::dump(int fd)
+{
+    char buf[128];
+    pthread_mutex_lock(&mLock);
+    int len = snprintf(buf, sizeof(buf),
+                       "%s (handle %d): enabled=%d control_syscalls=%d "
+                       "dropped=%d jitter_us=%lld\n",
+                       data_name ? data_name : mOwner ? "shared" : "none",
+                       mPendingEvent.sensor, mEnabled,
+                       mControlSyscalls, mDroppedEvents,
+                       mJitterEstimate / 1000);
+    pthread_mutex_unlock(&mLock);
+    write(fd, buf, len);
+}
+
+int64_t SamsungSensorBase::getFifoDeadline() const
+{
+    return mFifoCount ? mFifoDeadline : -1;
+}
+
+bool SamsungSensorBase::isFifoReady(int64_t now) const
+{
+    return mBatchTimeout <= 0 || mFlushPending ||
+           mFifoCount >= mFifoSize || now >= mFifoDeadline;
+}
+
+/* When the sample was taken, on the clock of getTimestamp(). Valid while
+ * readEvents() is running. */
+int64_t SamsungSensorBase::eventTimestamp(input_event const *event) const
+{
+    return timevalToNano(event->time) - mClockOffset;
+}
+
+/* Follows the sampling period with a running average and pulls each
+ * timestamp a quarter of the way from the predicted sample time towards the
+ * measured one, never past it: a sample is not reported as taken after it
+ * was stamped. Gaps and rate changes resynchronize on the measurement. */
+int64_t SamsungSensorBase::smoothTimestamp(int64_t t)
+{
+    const int64_t delta = t - mLastRawTimestamp;
+    const bool first = !mLastRawTimestamp;
+    mLastRawTimestamp = t;
+    if (first || delta <= 0) {
+        mLastTimestamp = t;
+        return t;
+    }
+    if (!mPeriodEstimate) {
+        mPeriodEstimate = delta;
+        mLastTimestamp = t;
+        return t;
+    }
+
+    mPeriodEstimate += (delta - mPeriodEstimate) / 8;
+    mJitterEstimate += (llabs(delta - mPeriodEstimate) - mJitterEstimate) / 8;
+
+    const int64_t predicted = mLastTimestamp + mPeriodEstimate;
+    int64_t ts = t;
+    if (llabs(t - predicted) < mPeriodEstimate / 2)
+        ts = predicted + (t - predicted) / 4;
+    if (ts > t)
+        ts = t;
+    if (ts <= mLastTimestamp)
+        ts = mLastTimestamp + 1;
+    mLastTimestamp = ts;
+    return ts;
+}
+
+void SamsungSensorBase::commitSlot(sensors_event_t *slot,
+                                   sensors_event_t *&data, int &count,
+                                   int &numEventReceived)
+{
+    if (mSmoothTimestamps)
+        slot->timestamp = smoothTimestamp(slot->timestamp);
+    if (slot == data) {
+        data++;
+        count--;
+        numEventReceived++;
+    } else {
+        if (!mFifoCount)
+            mFifoDeadline = getTimestamp() + mBatchTimeout;
+        mFifoCount++;
+    }
+}
+
+int SamsungSensorBase::drainFifo(sensors_event_t *data, int count)
+{
+    int numEvents = 0;
+    while (count && mFifoCount) {
+        *data++ = mFifo[mFifoHead];
+        mFifoHead = (mFifoHead + 1) % mFifoSize;
+        mFifoCount--;
+        count--;
+        numEvents++;
+    }
+    return numEvents;
+}
+
+/* Returns the next input event for this sensor without consuming it: from
+ * the fd, or for a sibling from what its owner forwarded. */
+bool SamsungSensorBase::readInput(input_event const **event)
+{
+    if (!mOwner)
+        return mInputReader.readEvent(data_fd, event);
+    if (!mForwardCount)
+        return false;
+    *event = &mForward[mForwardHead];
+    return true;
+}
+
+void SamsungSensorBase::consumeInput(input_event const *event)
+{
+    if (mOwner) {
+        mForwardHead = (mForwardHead + 1) % SAMSUNG_SENSOR_FORWARD_SIZE;
+        mForwardCount--;
+        return;
+    }
+    for (int i = 0; i < mNumSiblings; i++)
+        forwardInput(mSiblings[i], event);
+    mInputReader.next();
+}
+
+/* Whether every sibling that wants event has room for it. A sibling's
+ * value is only taken with room for the EV_SYN closing its report too, so
+ * reports are never split by a full ring. */
+bool SamsungSensorBase::canForward(input_event const *event) const
+{
+    if (event->type != EV_ABS)
+        return true;
+    for (int i = 0; i < mNumSiblings; i++) {
+        const SamsungSensorBase *sibling = mSiblings[i];
+        if (event->code == sibling->mSensorCode && sibling->mActive &&
+            sibling->mForwardCount + 2 > SAMSUNG_SENSOR_FORWARD_SIZE)
+            return false;
+    }
+    return true;
+}
+
+/* Passes an active sibling its own code and the EV_SYN closing each of its
+ * reports. canForward() has made sure there is room. */
+void SamsungSensorBase::forwardInput(SamsungSensorBase *sibling,
+                                     input_event const *event)
+{
+    if (event->type == EV_ABS && event->code == sibling->mSensorCode) {
+        if (!sibling->mActive)
+            return;
+        sibling->mForwardingReport = true;
+    } else if (event->type == EV_SYN && sibling->mForwardingReport) {
+        sibling->mForwardingReport = false;
+    } else {
+        return;
+    }
+
+    sibling->mForward[(sibling->mForwardHead + sibling->mForwardCount) %
+                      SAMSUNG_SENSOR_FORWARD_SIZE] = *event;
+    sibling->mForwardCount++;
+}
+
 int SamsungSensorBase::readEvents(sensors_event_t* data, int count)
 {
     if (count < 1)
         return -EINVAL;
 
-    pthread_mutex_lock(&mLock);
     int numEventReceived = 0;
 
+    processControl();
+
+    // the fd is edge-triggered, so the input below is still drained after
+    // the pending event
     if (mHasPendingEvent) {
         mHasPendingEvent = false;
-        if (mEnabled) {
+        if (mActive) {
             mPendingEvent.timestamp = getTimestamp();
-            *data = mPendingEvent;
+            *data++ = mPendingEvent;
+            count--;
             numEventReceived++;
+            // the driver's first report repeats it unless something changed
+            mLastValue = mPendingRawValue;
+            mHaveLastValue = true;
         }
-        goto done;
+    }
+
+    // samples queued before a latency change go out ahead of new ones
+    if (mFifoCount && isFifoReady(getTimestamp())) {
+        int nb = drainFifo(data, count);
+        data += nb;
+        count -= nb;
+        numEventReceived += nb;
+    }
+
+    // Each EV_ABS/EV_SYN group is converted in place into the next slot of
+    // the caller's array, or of the FIFO while batching, and committed on
+    // EV_SYN so repeated values within one report collapse to one event.
+    sensors_event_t *slot;
+    bool slotValid;
+    slot = NULL;
+    slotValid = false;
+    mClockOffset = 0;
+    if (!mMonotonicEvents) {
+        struct timespec rt;
+        clock_gettime(CLOCK_REALTIME, &rt);
+        mClockOffset = rt.tv_sec*1000000000LL + rt.tv_nsec - getTimestamp();
     }
 
     input_event const* event;
-    while (count && mInputReader.readEvent(data_fd, &event)) {
-        if (event->type == EV_ABS) {
-            if (event->code == mSensorCode) {
-                if (mEnabled && handleEvent(event)) {
-                    mPendingEvent.timestamp = timevalToNano(event->time);
-                    *data++ = mPendingEvent;
-                    count--;
-                    numEventReceived++;
+    mForwardBlocked = false;
+    while (readInput(&event)) {
+        if (!canForward(event)) {
+            // a sibling is full; hasPendingEvents() brings us back once it
+            // has been read, and nothing is lost meanwhile
+            mForwardBlocked = true;
+            break;
+        }
+        if (event->type == EV_ABS && event->code == mSensorCode && mActive) {
+            if (!slot) {
+                const bool batching = mBatchTimeout > 0;
+                if (batching && mFifoCount >= mFifoSize) {
+                    // a full FIFO is reported right away, so the input fd
+                    // is drained unless the caller runs out of room
+                    int nb = drainFifo(data, count);
+                    data += nb;
+                    count -= nb;
+                    numEventReceived += nb;
                 }
+                if (batching ? mFifoCount >= mFifoSize : (!count || mFifoCount))
+                    break;
+                slot = batching ?
+                        &mFifo[(mFifoHead + mFifoCount) % mFifoSize] : data;
+                slot->version = sizeof(sensors_event_t);
+                slot->sensor = mPendingEvent.sensor;
+                slot->type = mPendingEvent.type;
+            }
+            if (mChangeThreshold >= 0 && mHaveLastValue &&
+                abs(event->value - mLastValue) <= mChangeThreshold) {
+                mDroppedEvents++;
+            } else if (handleEvent(event, slot)) {
+                slot->timestamp = eventTimestamp(event);
+                slotValid = true;
+                mLastValue = event->value;
+                mHaveLastValue = true;
             }
+        } else if (event->type == EV_SYN && slot) {
+            if (slotValid) {
+                commitSlot(slot, data, count, numEventReceived);
+            }
+            slot = NULL;
+            slotValid = false;
         }
-        mInputReader.next();
+        consumeInput(event);
+    }
+    if (slot && slotValid) {
+        // the report was cut short; deliver what we have
+        commitSlot(slot, data, count, numEventReceived);
+    }
+
+    if (mFifoCount && isFifoReady(getTimestamp())) {
+        int nb = drainFifo(data, count);
+        data += nb;
+        count -= nb;
+        numEventReceived += nb;
+    }
+
+    if (mFlushPending && !mFifoCount && count) {
+        memset(data, 0, sizeof(*data));
+        data->version = META_DATA_VERSION;
+        data->type = SENSOR_TYPE_META_DATA;
+        data->meta_data.what = META_DATA_FLUSH_COMPLETE;
+        data->meta_data.sensor = mPendingEvent.sensor;
+        mFlushPending--;
+        numEventReceived++;
     }
 
-done:
-    pthread_mutex_unlock(&mLock);
     return numEventReceived;
 
 }
@@ -26,34 +26,136 @@
 #include "SensorBase.h"
 #include "SamsungSensorBase.h"
 #include "InputEventReader.h"
+#include "SensorControlQueue.h"
 
 /*****************************************************************************/
 
+/* Depth of the software FIFO used to batch events when the framework asks
+ * for a non-zero max_report_latency. Advertised as fifoMaxEventCount. */
+#define SAMSUNG_SENSOR_FIFO_SIZE 256
+
+/* Where the input class lives in sysfs. Builds that run the HAL against a
+ * fake sysfs tree, e.g. replaying recorded input events on a host, can
+ * point this elsewhere. */
+#ifndef SAMSUNG_SENSOR_SYSFS_ROOT
+#define SAMSUNG_SENSOR_SYSFS_ROOT "/sys/class/input/"
+#endif
+
+/* Default number of input_events read from the kernel in one readv(). */
+#define SAMSUNG_SENSOR_INPUT_EVENTS 64
+
+/* Input events an owner can hand to its sibling between two of the
+ * sibling's readEvents(), see attachTo(). Once a sibling has no room the
+ * owner stops reading, and its input waits in the reader and the kernel. */
+#define SAMSUNG_SENSOR_FORWARD_SIZE 64
+
+/* Siblings one owner can feed. */
+#define SAMSUNG_SENSOR_MAX_SIBLINGS 4
+
 class SamsungSensorBase:public SensorBase {
 protected:
+    /* Control plane: enable/setDelay/batch/flush, serialized by mLock. The
+     * poll thread never takes mLock; it learns about changes through
+     * mControl. */
     bool mEnabled;
+    char *mInputSysfsEnable;
+    char *mInputSysfsPollDelay;
+    int mInputSysfsEnableFd;
+    int mInputSysfsPollDelayFd;
+    int mControlSyscalls;
+    pthread_mutex_t mLock;
+    SensorControlQueue mControl;
+
+    /* Sensors fed by one input device share it: the owner reads the fd
+     * and forwards each sibling's reports, and the hardware is on while
+     * any of them is enabled. mSiblingsEnabled is under the owner's mLock;
+     * a sibling takes its own mLock before the owner's. */
+    SamsungSensorBase *mOwner;
+    SamsungSensorBase *mSiblings[SAMSUNG_SENSOR_MAX_SIBLINGS];
+    int mNumSiblings;
+    int mSiblingsEnabled;
+
+    /* Data path: owned by the poll thread. */
+    bool mActive;
     bool mHasPendingEvent;
+    int mPendingRawValue;
     InputEventCircularReader mInputReader;
     sensors_event_t mPendingEvent;
-    char *mInputSysfsEnable;
-    char *mInputSysfsPollDelay;
     int mSensorCode;
-    pthread_mutex_t mLock;
+    bool mForwardingReport;     // set by the owner mid-report
+    bool mForwardBlocked;       // owner: input left until a sibling has room
+    input_event mForward[SAMSUNG_SENSOR_FORWARD_SIZE];
+    size_t mForwardHead;
+    size_t mForwardCount;
+
+    /* On-change filtering: raw values within mChangeThreshold of the last
+     * reported one are dropped. -1 reports every sample. */
+    int mChangeThreshold;
+    bool mHaveLastValue;
+    int mLastValue;
+    int mDroppedEvents;
+
+    /* Timestamps: evdev stamps events with CLOCK_REALTIME unless it can be
+     * switched to CLOCK_MONOTONIC, the clock getTimestamp() and the MPL
+     * use. Continuous sensors can also have their sampling jitter
+     * smoothed out. */
+    bool mMonotonicEvents;
+    int64_t mClockOffset;       // realtime - monotonic, for this readEvents()
+    bool mSmoothTimestamps;
+    int64_t mLastRawTimestamp;
+    int64_t mLastTimestamp;
+    int64_t mPeriodEstimate;
+    int64_t mJitterEstimate;
+
+    sensors_event_t *mFifo;
+    size_t mFifoSize;
+    size_t mFifoHead;
+    size_t mFifoCount;
+    int64_t mFifoDeadline;
+    int64_t mBatchTimeout;
+    int mFlushPending;
 
     char *makeSysfsName(const char *input_name,
                         const char *input_file);
+    int setupInput();
+    int writeSysfs(int *fd, const char *name, const char *buf, size_t len);
 
     virtual int handleEnable(int en);
-    virtual bool handleEvent(input_event const * event);
+    virtual bool handleEvent(input_event const * event,
+                             sensors_event_t *data);
+
+    int postPendingEvent(float value, int rawValue);
+    void processControl();
+    int64_t eventTimestamp(input_event const *event) const;
+    int64_t smoothTimestamp(int64_t t);
+    void commitSlot(sensors_event_t *slot, sensors_event_t *&data,
+                    int &count, int &numEventReceived);
+    int drainFifo(sensors_event_t *data, int count);
+    bool isFifoReady(int64_t now) const;
+    bool readInput(input_event const **event);
+    void consumeInput(input_event const *event);
+    bool canForward(input_event const *event) const;
+    void forwardInput(SamsungSensorBase *sibling, input_event const *event);
+    void detach();
 
 public:
     SamsungSensorBase(const char* dev_name,
                       const char* data_name,
-                      int sensor_code);
+                      int sensor_code,
+                      size_t fifo_size = 0,
+                      size_t input_events = SAMSUNG_SENSOR_INPUT_EVENTS);
 
     virtual ~SamsungSensorBase();
+    int attachTo(SamsungSensorBase *owner);
+    int useInput(int fd, const char *inputName);
     virtual int enable(int32_t handle, int en);
     virtual int setDelay(int32_t handle, int64_t ns);
     virtual int readEvents(sensors_event_t *data, int count);
+    virtual bool hasPendingEvents() const;
+    virtual int batch(int32_t handle, int flags, int64_t period_ns,
+                      int64_t timeout);
+    virtual int flush(int32_t handle);
+    int64_t getFifoDeadline() const;
+    void dump(int fd);
 };
 #endif /* SAMSUNG_SENSORBASE_H */
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "SensorControlQueue.h"
+
+/*****************************************************************************/
+
+SensorControlQueue::SensorControlQueue()
+    : mHead(0),
+      mTail(0)
+{
+}
+
+bool SensorControlQueue::post(int what, int64_t arg, float value)
+{
+    const int32_t head = mHead;
+    const int32_t next = (head + 1) % SIZE;
+    if (next == android_atomic_acquire_load(&mTail)) {
+        ALOGE("sensor control queue full, dropping message %d", what);
+        return false;
+    }
+    mMessages[head].what = what;
+    mMessages[head].arg = arg;
+    mMessages[head].value = value;
+    android_atomic_release_store(next, &mHead);
+    return true;
+}
+
+bool SensorControlQueue::get(sensor_control_t *msg)
+{
+    const int32_t tail = mTail;
+    if (tail == android_atomic_acquire_load(&mHead))
+        return false;
+    *msg = mMessages[tail];
+    android_atomic_release_store((tail + 1) % SIZE, &mTail);
+    return true;
+}
+
+bool SensorControlQueue::isEmpty() const
+{
+    return mTail == android_atomic_acquire_load(&mHead);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_CONTROL_QUEUE_H
+#define ANDROID_SENSOR_CONTROL_QUEUE_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+enum {
+    SENSOR_CONTROL_ENABLE,      // arg: new enable state
+    SENSOR_CONTROL_BATCH,       // arg: max report latency in ns
+    SENSOR_CONTROL_FLUSH,
+    SENSOR_CONTROL_EVENT,       // value: reading to report right away,
+                                // arg: the raw input value it comes from
+};
+
+struct sensor_control_t {
+    int what;
+    int64_t arg;
+    float value;
+};
+
+/*
+ * Lock-free single-producer/single-consumer queue carrying control-plane
+ * changes from activate()/batch()/flush() to the poll thread, so that
+ * readEvents() never waits on a thread doing sysfs I/O. Producers must be
+ * serialized by the caller.
+ */
+class SensorControlQueue
+{
+    enum { SIZE = 16 };
+    sensor_control_t mMessages[SIZE];
+    volatile int32_t mHead;     // written by the producer only
+    volatile int32_t mTail;     // written by the consumer only
+
+public:
+    SensorControlQueue();
+    bool post(int what, int64_t arg = 0, float value = 0);
+    bool get(sensor_control_t *msg);
+    bool isEmpty() const;
+};
+
+/*****************************************************************************/
+
+#endif  /* ANDROID_SENSOR_CONTROL_QUEUE_H */
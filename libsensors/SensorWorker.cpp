@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <cutils/log.h>
+
+#include "SensorWorker.h"
+
+/*****************************************************************************/
+
+SensorWorker::SensorWorker(SensorBase *sensor)
+    : mSensor(sensor),
+      mNumFds(0),
+      mStarted(false),
+      mExit(false),
+      mLock(PTHREAD_MUTEX_INITIALIZER),
+      mSpaceCond(PTHREAD_COND_INITIALIZER),
+      mHead(0),
+      mCount(0)
+{
+    mEpollFd = epoll_create(MAX_FDS);
+    ALOGE_IF(mEpollFd<0, "error creating worker epoll fd (%s)", strerror(errno));
+
+    int result = pipe(mNotifyFds);
+    ALOGE_IF(result<0, "error creating worker pipe (%s)", strerror(errno));
+    fcntl(mNotifyFds[0], F_SETFL, O_NONBLOCK);
+    fcntl(mNotifyFds[1], F_SETFL, O_NONBLOCK);
+
+    result = pipe(mExitFds);
+    ALOGE_IF(result<0, "error creating worker exit pipe (%s)", strerror(errno));
+    addFd(mExitFds[0]);
+}
+
+SensorWorker::~SensorWorker()
+{
+    if (mStarted) {
+        pthread_mutex_lock(&mLock);
+        mExit = true;
+        pthread_cond_signal(&mSpaceCond);
+        pthread_mutex_unlock(&mLock);
+        const char msg = 'X';
+        write(mExitFds[1], &msg, 1);
+        pthread_join(mThread, NULL);
+    }
+    close(mExitFds[0]);
+    close(mExitFds[1]);
+    close(mNotifyFds[0]);
+    close(mNotifyFds[1]);
+    close(mEpollFd);
+}
+
+/* Adds one of the driver's fds; they are level-triggered since the driver
+ * decides how much it reads. An fd with a handler is serviced by it instead
+ * of readEvents(), on this thread, so nothing else has to touch the driver.
+ * Only called before start(). */
+int SensorWorker::addFd(int fd, fd_handler_t handler)
+{
+    if (fd < 0)
+        return -EINVAL;
+    if (mNumFds == MAX_FDS)
+        return -ENOSPC;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = mNumFds;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ALOGE("error adding fd to worker epoll set (%s)", strerror(errno));
+        return -errno;
+    }
+    mHandlers[mNumFds++] = handler;
+    return 0;
+}
+
+int SensorWorker::start()
+{
+    int err = pthread_create(&mThread, NULL, threadLoop, this);
+    if (err) {
+        ALOGE("error starting sensor worker (%s)", strerror(err));
+        return -err;
+    }
+    mStarted = true;
+    return 0;
+}
+
+int SensorWorker::getFd() const
+{
+    return mNotifyFds[0];
+}
+
+void *SensorWorker::threadLoop(void *arg)
+{
+    ((SensorWorker*)arg)->run();
+    return NULL;
+}
+
+void SensorWorker::run()
+{
+    // set when the driver claimed pending events but had none to give; wait
+    // for its fds then, or this would spin
+    bool idle = false;
+
+    for (;;) {
+        pthread_mutex_lock(&mLock);
+        while (mCount == QUEUE_SIZE && !mExit)
+            pthread_cond_wait(&mSpaceCond, &mLock);
+        const bool exiting = mExit;
+        const size_t space = QUEUE_SIZE - mCount;
+        pthread_mutex_unlock(&mLock);
+        if (exiting)
+            return;
+
+        if (idle || !mSensor->hasPendingEvents()) {
+            struct epoll_event events[MAX_FDS];
+            int n;
+            do {
+                n = epoll_wait(mEpollFd, events, MAX_FDS, -1);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                ALOGE("worker epoll_wait() failed (%s)", strerror(errno));
+                return;
+            }
+            for (int i = 0; i < n; i++) {
+                const uint32_t index = events[i].data.u32;
+                if (index == 0)
+                    return;     // mExitFds[0], added first
+                if (mHandlers[index])
+                    mHandlers[index](mSensor);
+            }
+        }
+
+        sensors_event_t buf[READ_SIZE];
+        int nb = mSensor->readEvents(buf, space < READ_SIZE ? space : READ_SIZE);
+        idle = nb <= 0;
+        if (nb <= 0)
+            continue;
+
+        pthread_mutex_lock(&mLock);
+        for (int i = 0; i < nb; i++) {
+            mQueue[(mHead + mCount) % QUEUE_SIZE] = buf[i];
+            mCount++;
+        }
+        pthread_mutex_unlock(&mLock);
+
+        const char msg = 'E';
+        write(mNotifyFds[1], &msg, 1);
+    }
+}
+
+int SensorWorker::readEvents(sensors_event_t *data, int count)
+{
+    // the poll thread waits edge-triggered, so empty the notify pipe
+    char msg[16];
+    while (read(mNotifyFds[0], msg, sizeof(msg)) > 0)
+        ;
+
+    int nb = 0;
+    pthread_mutex_lock(&mLock);
+    while (nb < count && mCount) {
+        data[nb++] = mQueue[mHead];
+        mHead = (mHead + 1) % QUEUE_SIZE;
+        mCount--;
+    }
+    if (nb)
+        pthread_cond_signal(&mSpaceCond);
+    pthread_mutex_unlock(&mLock);
+    return nb;
+}
+
+bool SensorWorker::hasPendingEvents() const
+{
+    return mCount != 0;
+}
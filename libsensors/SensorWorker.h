@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_WORKER_H
+#define ANDROID_SENSOR_WORKER_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "sensors.h"
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+/*
+ * Runs a driver's readEvents() on a thread of its own and queues the
+ * finished events for the poll thread, which only has to copy them out.
+ * Used for the MPL, whose fusion callbacks would otherwise delay the
+ * other sensors, proximity in particular.
+ *
+ * getFd() becomes readable whenever events are queued.
+ */
+class SensorWorker
+{
+public:
+    /* Called on the worker thread when an fd added with it is readable. */
+    typedef void (*fd_handler_t)(SensorBase *sensor);
+
+private:
+    enum { QUEUE_SIZE = 64, READ_SIZE = 16, MAX_FDS = 8 };
+
+    SensorBase* const mSensor;
+    int mEpollFd;
+    int mNumFds;
+    fd_handler_t mHandlers[MAX_FDS];
+    int mNotifyFds[2];      // worker -> poll thread
+    int mExitFds[2];        // destructor -> worker
+    pthread_t mThread;
+    bool mStarted;
+    bool mExit;
+
+    pthread_mutex_t mLock;
+    pthread_cond_t mSpaceCond;
+    sensors_event_t mQueue[QUEUE_SIZE];
+    size_t mHead;
+    volatile size_t mCount;
+
+    static void *threadLoop(void *arg);
+    void run();
+
+public:
+    SensorWorker(SensorBase *sensor);
+    ~SensorWorker();
+    int addFd(int fd, fd_handler_t handler = NULL);
+    int start();
+    int getFd() const;
+    int readEvents(sensors_event_t *data, int count);
+    bool hasPendingEvents() const;
+};
+
+/*****************************************************************************/
+
+#endif  /* ANDROID_SENSOR_WORKER_H */
@@ -28,14 +28,20 @@
 
 #define TEMPERATURE_CELCIUS (1.0f/10.0f)
 
-TemperatureSensor::TemperatureSensor()
-    : SamsungSensorBase(NULL, "barometer", ABS_MISC)
+/* The BMP180 reports temperature alongside pressure on the same input
+ * device, so the pressure sensor reads it for both of us. */
+TemperatureSensor::TemperatureSensor(SamsungSensorBase *pressure)
+    : SamsungSensorBase(NULL, NULL, ABS_MISC,
+                        SAMSUNG_SENSOR_FIFO_SIZE)
 {
+    attachTo(pressure);
     mPendingEvent.sensor = ID_T;
     mPendingEvent.type = SENSOR_TYPE_AMBIENT_TEMPERATURE;
+    mSmoothTimestamps = true;
 }
 
-bool TemperatureSensor::handleEvent(input_event const *event) {
-    mPendingEvent.temperature = event->value * TEMPERATURE_CELCIUS;
+bool TemperatureSensor::handleEvent(input_event const *event,
+                                    sensors_event_t *data) {
+    data->temperature = event->value * TEMPERATURE_CELCIUS;
     return true;
 }
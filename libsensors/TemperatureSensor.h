@@ -31,10 +31,11 @@
 struct input_event;
 
 class TemperatureSensor:public SamsungSensorBase {
-    virtual bool handleEvent(input_event const * event);
+    virtual bool handleEvent(input_event const * event,
+                             sensors_event_t *data);
 
 public:
-    TemperatureSensor();
+    TemperatureSensor(SamsungSensorBase *pressure);
 };
 
 /*****************************************************************************/
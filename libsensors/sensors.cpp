@@ -26,10 +26,13 @@
 #include <math.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sys/epoll.h>
 #include <stdlib.h>
 
 #include <linux/input.h>
 
+#include <cutils/properties.h>
+#include <hardware_legacy/power.h>
 #include <utils/Atomic.h>
 #include <utils/Log.h>
 
@@ -40,6 +43,9 @@
 #include "ProximitySensor.h"
 #include "PressureSensor.h"
 #include "TemperatureSensor.h"
+#include "AltitudeSensor.h"
+#include "PressureTendencySensor.h"
+#include "SensorWorker.h"
 
 
 /*****************************************************************************/
@@ -48,6 +54,17 @@
 
 #define LIGHT_SENSOR_POLLTIME    2000000000
 
+/* HAL state written when a sensor is deactivated while
+ * SENSORS_STATS_PROPERTY is set; collected by dumpstate */
+#define SENSORS_DUMP_FILE "/data/system/sensors.tuna.txt"
+
+/* set to 1 to run the MPL on a worker thread instead of the poll thread */
+#define SENSORS_MPL_WORKER_PROPERTY "ro.sensors.mpl_worker"
+
+/* held from the moment a wake-up event is read until the framework comes back
+ * for more, so the device cannot suspend with the event still in our hands */
+#define SENSORS_WAKE_LOCK "SensorsHAL_WAKEUP"
+
 #define SENSORS_ROTATION_VECTOR  (1<<ID_RV)
 #define SENSORS_LINEAR_ACCEL     (1<<ID_LA)
 #define SENSORS_GRAVITY          (1<<ID_GR)
@@ -75,37 +92,22 @@
 #define AKM_DEBUG 0
 #define AKM_DATA 0
 
+static int64_t getMonotonicTime()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
 /*****************************************************************************/
 
 /* The SENSORS Module */
-#define LOCAL_SENSORS (4)
-static struct sensor_t sSensorList[LOCAL_SENSORS + MPLSensor::numSensors] = {
-      { "GP2A Light sensor",
-          "Sharp",
-          1, SENSORS_LIGHT_HANDLE,
-          SENSOR_TYPE_LIGHT, powf(10, 125.0f/ 24.0f) * 4, 1.0f, 0.75f, 0, 0, 0, 0, 0, 0,
-          SENSOR_FLAG_ON_CHANGE_MODE,
-	  { } },
-      { "GP2A Proximity sensor",
-          "Sharp",
-          1, SENSORS_PROXIMITY_HANDLE,
-          SENSOR_TYPE_PROXIMITY, 5.0f, 5.0f, 0.75f, 0, 0, 0, 0, 0, 0,
-	  SENSOR_FLAG_WAKE_UP | SENSOR_FLAG_ON_CHANGE_MODE,
-	  { } },
-      { "BMP180 Pressure sensor",
-          "Bosch",
-          1, SENSORS_PRESSURE_HANDLE,
-          SENSOR_TYPE_PRESSURE, 1100.0f, 0.01f, 0.67f, 20000, 0, 0, 0, 0, 20000,
-	  SENSOR_FLAG_CONTINUOUS_MODE,
-	  { } },
-      { "BMP180 Temperature sensor",
-          "Bosch",
-          1, SENSORS_TEMPERATURE_HANDLE,
-          SENSOR_TYPE_AMBIENT_TEMPERATURE, 850.0f, 0.1f, 0.67f, 20000, 0, 0, 0, 0, 20000,
-          SENSOR_FLAG_CONTINUOUS_MODE,
-      { } }
-};
-static int numSensors = LOCAL_SENSORS;
+#define LOCAL_SENSORS (6)
+
+/* Filled in when the device is opened: the local sensors whose hardware
+ * was found, see sensors_poll_context_t::sLocalDrivers, then the MPL's. */
+static struct sensor_t sSensorList[LOCAL_SENSORS + MPLSensor::numSensors];
+static int numSensors = 0;
 
 static int open_sensors(const struct hw_module_t* module, const char* id,
                         struct hw_device_t** device);
@@ -138,13 +140,16 @@ struct sensors_module_t HAL_MODULE_INFO_SYM = {
 };
 
 struct sensors_poll_context_t {
-    struct sensors_poll_device_t device; // must be first
+    struct sensors_poll_device_1 device; // must be first
 
         sensors_poll_context_t();
         ~sensors_poll_context_t();
     int activate(int handle, int enabled);
     int setDelay(int handle, int64_t ns);
     int pollEvents(sensors_event_t* data, int count);
+    int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
+    int flush(int handle);
+    void dump(int fd);
 
 private:
     enum {
@@ -155,6 +160,8 @@ private:
         proximity,
         pressure,
         temperature,
+        altitude,               // derived sensors are read after their owner
+        pressure_tendency,
         numSensorDrivers,       // wake pipe goes here
         mpl_power,              //special handle for MPL pm interaction
         numFds,
@@ -162,11 +169,100 @@ private:
 
     static const size_t wake = numFds - 2;
     static const char WAKE_MESSAGE = 'W';
-    struct pollfd mPollFds[numFds];
+    static const int MAX_MPL_FLUSHES = 16;
+    static const int numHandles = ARRAY_SIZE(sSensorList);
+    int mEpollFd;
+    int mPollFds[numFds];
+    bool mReady[numFds];       // signalled by epoll, not yet drained
     int mWritePipeFd;
     SensorBase* mSensors[numSensorDrivers];
+    SensorWorker* mMplWorker;   // optional, see SENSORS_MPL_WORKER_PROPERTY
+
+    // the MPL has no FIFO, so its flushes complete as soon as poll() runs
+    pthread_mutex_t mFlushLock;
+    int mMplFlushes[MAX_MPL_FLUSHES];
+    int mNumMplFlushes;
+
+    bool mWakeLockHeld;         // poll thread only
+
+    // rate arbitration, indexed by position in sSensorList
+    pthread_mutex_t mRateLock;
+    bool mHandleEnabled[numHandles];
+    bool mContinuous[numHandles];
+    int64_t mRequestedPeriod[numHandles];   // -1 until the framework asks
+    int64_t mDecimatePeriod[numHandles];    // 0 when the hardware matches
+    int64_t mNextReport[numHandles];        // next sample due, see decimate()
+    int64_t mAppliedPeriod[numSensorDrivers];
+    sensors_handle_stats_t mStats[numHandles];   // also under mRateLock
+
+    /* One entry per local sensor. A driver is only created, and its sensor
+     * only listed, if the input device it reads is registered; a driver
+     * without an input of its own is fed by its owner and needs that. */
+    struct local_driver_t {
+        int index;              // slot in mSensors
+        const char* input;      // input device name, NULL when fed by owner
+        int owner;              // driver reading our input, or -1
+        SensorBase* (*create)(SensorBase* owner);
+        /* Fastest the owner is run for us. On-change sensors are listed
+         * with minDelay 0, since below HAL 1.3 the framework takes any
+         * other value to mean continuous, so their rate is bounded here. */
+        int64_t minPeriod;
+        struct sensor_t sensor;
+    };
+    static const local_driver_t sLocalDrivers[LOCAL_SENSORS];
+    int probeLocalDrivers();
+
+    void sendWakeMessage();
+    int addPollFd(int index, int fd, bool edgeTriggered, bool wakeUp = false);
+    void removePollFd(int index);
+    int getPollTimeout();
+    int readMplFlushes(sensors_event_t* data, int count);
+    int readWakeUpEvents(sensors_event_t* data, int count);
+
+    // with a worker, the MPL is never touched from the poll thread
+    bool driverHasPendingEvents(int index) const {
+        if (index <= mpl_timer && mMplWorker)
+            return mMplWorker->hasPendingEvents();
+        return mSensors[index] && mSensors[index]->hasPendingEvents();
+    }
+
+    int readDriverEvents(int index, sensors_event_t* data, int count) {
+        if (index <= mpl_timer && mMplWorker)
+            return mMplWorker->readEvents(data, count);
+        return mSensors[index] ? mSensors[index]->readEvents(data, count) : 0;
+    }
+    int setRate(int handle, int64_t ns);
+    int applyRate(int handle);
+    void updateDecimation();
+    int decimate(sensors_event_t* data, int count);
+    void writeStats();
+
+    int handleToSlot(int handle) const {
+        for (int i=0 ; i<numSensors ; i++) {
+            if (sSensorList[i].handle == handle)
+                return i;
+        }
+        return -EINVAL;
+    }
+
+    // sensors fed by another driver share its poll_delay node
+    int handleToRateGroup(int handle) const {
+        int index = handleToDriver(handle);
+        for (int i=0 ; i<LOCAL_SENSORS ; i++) {
+            if (sLocalDrivers[i].index == index && sLocalDrivers[i].owner >= 0)
+                return sLocalDrivers[i].owner;
+        }
+        return index;
+    }
 
     int handleToDriver(int handle) const {
+        int index = handleToIndex(handle);
+        if (index >= 0 && !mSensors[index])
+            return -EINVAL;     // not present on this board
+        return index;
+    }
+
+    int handleToIndex(int handle) const {
         switch (handle) {
             case ID_RV:
             case ID_LA:
@@ -184,6 +280,10 @@ private:
                 return pressure;
             case ID_T:
                 return temperature;
+            case ID_ALT:
+                return altitude;
+            case ID_PT:
+                return pressure_tendency;
         }
         return -EINVAL;
     }
@@ -191,50 +291,222 @@ private:
 
 /*****************************************************************************/
 
+static void handleMplPowerEvent(SensorBase* mpl)
+{
+    ((MPLSensor*)mpl)->handlePowerEvent();
+}
+
+static SensorBase* createLightSensor(SensorBase* owner)
+{
+    return new LightSensor();
+}
+
+static SensorBase* createProximitySensor(SensorBase* owner)
+{
+    return new ProximitySensor();
+}
+
+static SensorBase* createPressureSensor(SensorBase* owner)
+{
+    return new PressureSensor();
+}
+
+static SensorBase* createTemperatureSensor(SensorBase* owner)
+{
+    return new TemperatureSensor(static_cast<SamsungSensorBase*>(owner));
+}
+
+static SensorBase* createAltitudeSensor(SensorBase* owner)
+{
+    return new AltitudeSensor(static_cast<SamsungSensorBase*>(owner));
+}
+
+static SensorBase* createPressureTendencySensor(SensorBase* owner)
+{
+    return new PressureTendencySensor(static_cast<SamsungSensorBase*>(owner));
+}
+
+const sensors_poll_context_t::local_driver_t
+sensors_poll_context_t::sLocalDrivers[LOCAL_SENSORS] = {
+      { light, "lightsensor-level", -1, createLightSensor, 0,
+        { "GP2A Light sensor",
+          "Sharp",
+          1, SENSORS_LIGHT_HANDLE,
+          SENSOR_TYPE_LIGHT, powf(10, 125.0f/ 24.0f) * 4, 1.0f, 0.75f, 0,
+          SAMSUNG_SENSOR_FIFO_SIZE, SAMSUNG_SENSOR_FIFO_SIZE, 0, 0, 0,
+          SENSOR_FLAG_ON_CHANGE_MODE,
+          { } } },
+      { proximity, "proximity", -1, createProximitySensor, 0,
+        { "GP2A Proximity sensor",
+          "Sharp",
+          1, SENSORS_PROXIMITY_HANDLE,
+          SENSOR_TYPE_PROXIMITY, 5.0f, 5.0f, 0.75f, 0, 0, 0, 0, 0, 0,
+          SENSOR_FLAG_WAKE_UP | SENSOR_FLAG_ON_CHANGE_MODE,
+          { } } },
+      { pressure, "barometer", -1, createPressureSensor, 0,
+        { "BMP180 Pressure sensor",
+          "Bosch",
+          1, SENSORS_PRESSURE_HANDLE,
+          SENSOR_TYPE_PRESSURE, 1100.0f, 0.01f, 0.67f, 20000,
+          SAMSUNG_SENSOR_FIFO_SIZE, SAMSUNG_SENSOR_FIFO_SIZE, 0, 0, 20000,
+          SENSOR_FLAG_CONTINUOUS_MODE,
+          { } } },
+      { temperature, NULL, pressure, createTemperatureSensor, 0,
+        { "BMP180 Temperature sensor",
+          "Bosch",
+          1, SENSORS_TEMPERATURE_HANDLE,
+          SENSOR_TYPE_AMBIENT_TEMPERATURE, 850.0f, 0.1f, 0.67f, 20000,
+          SAMSUNG_SENSOR_FIFO_SIZE, SAMSUNG_SENSOR_FIFO_SIZE, 0, 0, 20000,
+          SENSOR_FLAG_CONTINUOUS_MODE,
+          { } } },
+      { altitude, NULL, pressure, createAltitudeSensor, 200000000,
+        { "BMP180 Altitude",
+          "Samsung",
+          1, ID_ALT,
+          SENSOR_TYPE_TUNA_ALTITUDE, 9200.0f, 0.1f, 0.67f, 0,
+          SAMSUNG_SENSOR_FIFO_SIZE, SAMSUNG_SENSOR_FIFO_SIZE,
+          SENSOR_STRING_TYPE_TUNA_ALTITUDE, 0, 0,
+          SENSOR_FLAG_ON_CHANGE_MODE,
+          { } } },
+      { pressure_tendency, NULL, pressure, createPressureTendencySensor,
+        1000000000,
+        { "BMP180 Pressure tendency",
+          "Samsung",
+          1, ID_PT,
+          SENSOR_TYPE_TUNA_PRESSURE_TENDENCY, 100.0f, 0.1f, 0.67f, 0,
+          0, 0,
+          SENSOR_STRING_TYPE_TUNA_PRESSURE_TENDENCY, 0, 0,
+          SENSOR_FLAG_ON_CHANGE_MODE,
+          { } } },
+};
+
+/* Looks the name up in sysfs, which is far cheaper than the open() and
+ * EVIOCGNAME of every /dev/input node a driver does to find its device. */
+static bool inputDevicePresent(const char* name)
+{
+    DIR* dir = opendir(SAMSUNG_SENSOR_SYSFS_ROOT);
+    if (!dir) {
+        // can't tell, let the driver look for itself
+        return true;
+    }
+
+    bool found = false;
+    struct dirent* de;
+    while (!found && (de = readdir(dir))) {
+        if (strncmp(de->d_name, "input", 5))
+            continue;
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s%s/name",
+                 SAMSUNG_SENSOR_SYSFS_ROOT, de->d_name);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            continue;
+        char buf[80];
+        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n <= 0)
+            continue;
+        buf[n] = 0;
+        if (buf[n-1] == '\n')
+            buf[n-1] = 0;
+        found = !strcmp(buf, name);
+    }
+    closedir(dir);
+    return found;
+}
+
+/* Creates the local drivers whose hardware is present and lists their
+ * sensors at the start of sSensorList. Returns how many were listed. */
+int sensors_poll_context_t::probeLocalDrivers()
+{
+    int count = 0;
+    for (int i=0 ; i<LOCAL_SENSORS ; i++) {
+        const local_driver_t& d = sLocalDrivers[i];
+        SensorBase* owner = d.owner >= 0 ? mSensors[d.owner] : NULL;
+        mSensors[d.index] = NULL;
+        if (d.input ? !inputDevicePresent(d.input) : !owner) {
+            ALOGW("%s not found, not listing it", d.sensor.name);
+            continue;
+        }
+        mSensors[d.index] = d.create(owner);
+        sSensorList[count++] = d.sensor;
+    }
+    return count;
+}
+
 sensors_poll_context_t::sensors_poll_context_t()
+    : mFlushLock(PTHREAD_MUTEX_INITIALIZER),
+      mNumMplFlushes(0),
+      mWakeLockHeld(false),
+      mRateLock(PTHREAD_MUTEX_INITIALIZER)
 {
     FUNC_LOG;
     MPLSensor* p_mplsen = new MPLSensor();
     setCallbackObject(p_mplsen); //setup the callback object for handing mpl callbacks
-    numSensors =
-        LOCAL_SENSORS +
-        p_mplsen->populateSensorList(sSensorList + LOCAL_SENSORS,
-                                     sizeof(sSensorList[0]) * (ARRAY_SIZE(sSensorList) - LOCAL_SENSORS));
+    numSensors = probeLocalDrivers();
+    numSensors +=
+        p_mplsen->populateSensorList(sSensorList + numSensors,
+                                     sizeof(sSensorList[0]) * (ARRAY_SIZE(sSensorList) - numSensors));
 
-    mSensors[mpl] = p_mplsen;
-    mPollFds[mpl].fd = mSensors[mpl]->getFd();
-    mPollFds[mpl].events = POLLIN;
-    mPollFds[mpl].revents = 0;
+    for (int i=0 ; i<numHandles ; i++) {
+        mHandleEnabled[i] = false;
+        mContinuous[i] = !(sSensorList[i].flags &
+                (SENSOR_FLAG_ON_CHANGE_MODE | SENSOR_FLAG_ONE_SHOT_MODE));
+        mRequestedPeriod[i] = -1;
+        mDecimatePeriod[i] = 0;
+        mNextReport[i] = 0;
+        memset(&mStats[i], 0, sizeof(mStats[i]));
+        mStats[i].handle = sSensorList[i].handle;
+    }
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        mAppliedPeriod[i] = -1;
+    }
 
-    mSensors[mpl_accel] = mSensors[mpl];
-    mPollFds[mpl_accel].fd = ((MPLSensor*)mSensors[mpl])->getAccelFd();
-    mPollFds[mpl_accel].events = POLLIN;
-    mPollFds[mpl_accel].revents = 0;
+    mEpollFd = epoll_create(numFds);
+    ALOGE_IF(mEpollFd<0, "error creating epoll fd (%s)", strerror(errno));
+    for (int i=0 ; i<numFds ; i++) {
+        mPollFds[i] = -1;
+        mReady[i] = false;
+    }
 
+    // the MPL decides how its fds are drained, so they stay level-triggered
+    mSensors[mpl] = p_mplsen;
+    mSensors[mpl_accel] = mSensors[mpl];
     mSensors[mpl_timer] = mSensors[mpl];
-    mPollFds[mpl_timer].fd = ((MPLSensor*)mSensors[mpl])->getTimerFd();
-    mPollFds[mpl_timer].events = POLLIN;
-    mPollFds[mpl_timer].revents = 0;
-
-    mSensors[light] = new LightSensor();
-    mPollFds[light].fd = mSensors[light]->getFd();
-    mPollFds[light].events = POLLIN;
-    mPollFds[light].revents = 0;
-
-    mSensors[proximity] = new ProximitySensor();
-    mPollFds[proximity].fd = mSensors[proximity]->getFd();
-    mPollFds[proximity].events = POLLIN;
-    mPollFds[proximity].revents = 0;
-
-    mSensors[pressure] = new PressureSensor();
-    mPollFds[pressure].fd = mSensors[pressure]->getFd();
-    mPollFds[pressure].events = POLLIN;
-    mPollFds[pressure].revents = 0;
-
-    mSensors[temperature] = new TemperatureSensor();
-    mPollFds[temperature].fd = mSensors[temperature]->getFd();
-    mPollFds[temperature].events = POLLIN;
-    mPollFds[temperature].revents = 0;
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get(SENSORS_MPL_WORKER_PROPERTY, value, "0");
+    mMplWorker = NULL;
+    if (!strcmp(value, "1")) {
+        mMplWorker = new SensorWorker(p_mplsen);
+        mMplWorker->addFd(p_mplsen->getFd());
+        mMplWorker->addFd(p_mplsen->getAccelFd());
+        mMplWorker->addFd(p_mplsen->getTimerFd());
+        // power events change MPL state, so they are handled on the thread
+        // that runs its readEvents()
+        mMplWorker->addFd(p_mplsen->getPowerFd(), handleMplPowerEvent);
+        if (mMplWorker->start()) {
+            delete mMplWorker;
+            mMplWorker = NULL;
+        }
+    }
+
+    if (mMplWorker) {
+        // the worker signals when it has finished events queued
+        addPollFd(mpl, mMplWorker->getFd(), true);
+    } else {
+        addPollFd(mpl, mSensors[mpl]->getFd(), false);
+        addPollFd(mpl_accel, p_mplsen->getAccelFd(), false);
+        addPollFd(mpl_timer, p_mplsen->getTimerFd(), false);
+    }
+
+    // drivers fed by an owner have no fd of their own and are skipped here
+    for (int i=0 ; i<LOCAL_SENSORS ; i++) {
+        const local_driver_t& d = sLocalDrivers[i];
+        if (mSensors[d.index] && d.input)
+            addPollFd(d.index, mSensors[d.index]->getFd(), true,
+                      d.sensor.flags & SENSOR_FLAG_WAKE_UP);
+    }
 
     int wakeFds[2];
     int result = pipe(wakeFds);
@@ -242,25 +514,70 @@ sensors_poll_context_t::sensors_poll_context_t()
     fcntl(wakeFds[0], F_SETFL, O_NONBLOCK);
     fcntl(wakeFds[1], F_SETFL, O_NONBLOCK);
     mWritePipeFd = wakeFds[1];
+    addPollFd(wake, wakeFds[0], true);
 
-    mPollFds[wake].fd = wakeFds[0];
-    mPollFds[wake].events = POLLIN;
-    mPollFds[wake].revents = 0;
-
-    //setup MPL pm interaction handle
-    mPollFds[mpl_power].fd = ((MPLSensor*)mSensors[mpl])->getPowerFd();
-    mPollFds[mpl_power].events = POLLIN;
-    mPollFds[mpl_power].revents = 0;
+    //setup MPL pm interaction handle, unless the worker owns it
+    if (!mMplWorker)
+        addPollFd(mpl_power, ((MPLSensor*)mSensors[mpl])->getPowerFd(), false);
 }
 
 sensors_poll_context_t::~sensors_poll_context_t()
 {
     FUNC_LOG;
+    delete mMplWorker;
     for (int i=0 ; i<numSensorDrivers ; i++) {
+        removePollFd(i);
         delete mSensors[i];
     }
-    close(mPollFds[wake].fd);
+    close(mPollFds[wake]);
     close(mWritePipeFd);
+    close(mEpollFd);
+    if (mWakeLockHeld)
+        release_wake_lock(SENSORS_WAKE_LOCK);
+}
+
+/* Registers fd with the epoll set under the given index, which comes back in
+ * epoll_event.data. Edge-triggered fds must be read until EAGAIN before they
+ * signal again. Wake-up fds ask the kernel to keep the system awake from the
+ * interrupt until epoll_wait() returns, where the kernel supports it. */
+int sensors_poll_context_t::addPollFd(int index, int fd, bool edgeTriggered, bool wakeUp)
+{
+    if (fd < 0)
+        return -EINVAL;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (edgeTriggered ? EPOLLET : 0);
+    ev.data.u32 = index;
+#ifdef EPOLLWAKEUP
+    if (wakeUp) {
+        ev.events |= EPOLLWAKEUP;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+            mPollFds[index] = fd;
+            mReady[index] = false;
+            return 0;
+        }
+        // older kernels reject the flag; the HAL wakelock still covers us
+        ALOGW("EPOLLWAKEUP not supported for fd %d (%s)", index, strerror(errno));
+        ev.events &= ~EPOLLWAKEUP;
+    }
+#endif
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ALOGE("error adding fd %d to epoll set (%s)", index, strerror(errno));
+        return -errno;
+    }
+    mPollFds[index] = fd;
+    mReady[index] = false;
+    return 0;
+}
+
+void sensors_poll_context_t::removePollFd(int index)
+{
+    if (mPollFds[index] < 0)
+        return;
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, mPollFds[index], NULL);
+    mPollFds[index] = -1;
+    mReady[index] = false;
 }
 
 int sensors_poll_context_t::activate(int handle, int enabled)
@@ -270,19 +587,356 @@ int sensors_poll_context_t::activate(int handle, int enabled)
     if (index < 0) return index;
     int err =  mSensors[index]->enable(handle, enabled);
     if (!err) {
-        const char wakeMessage(WAKE_MESSAGE);
-        int result = write(mWritePipeFd, &wakeMessage, 1);
-        ALOGE_IF(result<0, "error sending wake message (%s)", strerror(errno));
+        const int slot = handleToSlot(handle);
+        pthread_mutex_lock(&mRateLock);
+        mHandleEnabled[slot] = enabled;
+        mNextReport[slot] = 0;
+        mStats[slot].enabled = enabled;
+        if (enabled) {
+            // statistics cover one activation
+            memset(&mStats[slot], 0, sizeof(mStats[slot]));
+            mStats[slot].handle = handle;
+            mStats[slot].enabled = 1;
+        }
+        updateDecimation();
+        pthread_mutex_unlock(&mRateLock);
+        if (index != mpl)
+            applyRate(handle);
+        sendWakeMessage();
+    }
+    if (!enabled && !err) {
+        // debugging only, this is file I/O on the binder thread
+        char value[PROPERTY_VALUE_MAX];
+        property_get(SENSORS_STATS_PROPERTY, value, "0");
+        if (!strcmp(value, "1")) {
+            int fd = open(SENSORS_DUMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+            if (fd >= 0) {
+                dump(fd);
+                close(fd);
+            }
+            writeStats();
+        }
     }
     return err;
 }
 
+void sensors_poll_context_t::dump(int fd)
+{
+    for (int i=light ; i<numSensorDrivers ; i++) {
+        if (mSensors[i])
+            ((SamsungSensorBase*)mSensors[i])->dump(fd);
+    }
+
+    // decimate() takes mRateLock for every batch, so don't write under it
+    sensors_handle_stats_t stats[numHandles];
+    int64_t requested[numHandles];
+    pthread_mutex_lock(&mRateLock);
+    memcpy(stats, mStats, sizeof(stats));
+    memcpy(requested, mRequestedPeriod, sizeof(requested));
+    pthread_mutex_unlock(&mRateLock);
+
+    for (int i=0 ; i<numSensors ; i++) {
+        const sensors_handle_stats_t& st = stats[i];
+        if (!st.delivered && !st.dropped)
+            continue;
+        char buf[256];
+        float achieved = 0;
+        if (st.delivered > 1 && st.last_timestamp > st.first_timestamp)
+            achieved = (st.delivered - 1) * 1e9f /
+                    (st.last_timestamp - st.first_timestamp);
+        int len = snprintf(buf, sizeof(buf),
+                           "%s (handle %d): delivered=%llu dropped=%llu "
+                           "requested=%.1fHz achieved=%.1fHz latency_ms=",
+                           sSensorList[i].name, st.handle,
+                           (unsigned long long)st.delivered,
+                           (unsigned long long)st.dropped,
+                           requested[i] > 0 ? 1e9f / requested[i] : 0.0f,
+                           achieved);
+        for (int b=0 ; b<SENSORS_LATENCY_BUCKETS ; b++) {
+            const bool last = b == SENSORS_LATENCY_BUCKETS-1;
+            if (len >= (int)sizeof(buf))
+                break;
+            len += snprintf(buf + len, sizeof(buf) - len, "%s%s%d:%u",
+                            b ? "," : "", last ? ">=" : "<",
+                            last ? 1 << (b-1) : 1 << b, st.latency[b]);
+        }
+        if (len < (int)sizeof(buf))
+            len += snprintf(buf + len, sizeof(buf) - len, "\n");
+        write(fd, buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+    }
+}
+
+void sensors_poll_context_t::writeStats()
+{
+    int fd = open(SENSORS_STATS_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if (fd < 0) {
+        ALOGE("unable to open %s (%s)", SENSORS_STATS_FILE, strerror(errno));
+        return;
+    }
+    sensors_stats_header_t header;
+    header.magic = SENSORS_STATS_MAGIC;
+    header.version = SENSORS_STATS_VERSION;
+    header.count = numSensors;
+    header.record_size = sizeof(sensors_handle_stats_t);
+
+    sensors_handle_stats_t stats[numHandles];
+    pthread_mutex_lock(&mRateLock);
+    for (int i=0 ; i<numSensors ; i++)
+        mStats[i].requested_period_ns = mRequestedPeriod[i];
+    memcpy(stats, mStats, sizeof(stats));
+    pthread_mutex_unlock(&mRateLock);
+
+    write(fd, &header, sizeof(header));
+    write(fd, stats, numSensors * sizeof(stats[0]));
+    close(fd);
+}
+
+void sensors_poll_context_t::sendWakeMessage()
+{
+    const char wakeMessage(WAKE_MESSAGE);
+    int result = write(mWritePipeFd, &wakeMessage, 1);
+    ALOGE_IF(result<0, "error sending wake message (%s)", strerror(errno));
+}
+
 int sensors_poll_context_t::setDelay(int handle, int64_t ns)
 {
     FUNC_LOG;
     int index = handleToDriver(handle);
     if (index < 0) return index;
-    return mSensors[index]->setDelay(handle, ns);
+    return setRate(handle, ns);
+}
+
+/* Records the period asked for handle and only reprograms the hardware when
+ * the fastest period among the enabled handles sharing it changes. Handles
+ * asking for a slower rate than the hardware runs at are decimated in
+ * pollEvents(). */
+int sensors_poll_context_t::setRate(int handle, int64_t ns)
+{
+    const int slot = handleToSlot(handle);
+    for (int i=0 ; i<LOCAL_SENSORS ; i++) {
+        if (sLocalDrivers[i].sensor.handle == handle &&
+            ns < sLocalDrivers[i].minPeriod)
+            ns = sLocalDrivers[i].minPeriod;
+    }
+    pthread_mutex_lock(&mRateLock);
+    const bool changed = mRequestedPeriod[slot] != ns;
+    mRequestedPeriod[slot] = ns;
+    pthread_mutex_unlock(&mRateLock);
+
+    int index = handleToDriver(handle);
+    if (index == mpl) {
+        // the MPL already runs at the fastest rate of its handles
+        int err = changed ? mSensors[index]->setDelay(handle, ns) : 0;
+        pthread_mutex_lock(&mRateLock);
+        updateDecimation();
+        pthread_mutex_unlock(&mRateLock);
+        return err;
+    }
+    return applyRate(handle);
+}
+
+int sensors_poll_context_t::applyRate(int handle)
+{
+    const int group = handleToRateGroup(handle);
+    int64_t period = -1;
+
+    pthread_mutex_lock(&mRateLock);
+    for (int i=0 ; i<numHandles ; i++) {
+        if (!mHandleEnabled[i] || mRequestedPeriod[i] < 0 ||
+            handleToRateGroup(sSensorList[i].handle) != group)
+            continue;
+        if (period < 0 || mRequestedPeriod[i] < period)
+            period = mRequestedPeriod[i];
+    }
+    const bool changed = period >= 0 && period != mAppliedPeriod[group];
+    if (changed)
+        mAppliedPeriod[group] = period;
+    updateDecimation();
+    pthread_mutex_unlock(&mRateLock);
+
+    if (!changed)
+        return 0;
+    int err = mSensors[group]->setDelay(handle, period);
+    if (err) {
+        // try again on the next request
+        pthread_mutex_lock(&mRateLock);
+        mAppliedPeriod[group] = -1;
+        pthread_mutex_unlock(&mRateLock);
+    }
+    return err;
+}
+
+/* Called with mRateLock held. */
+void sensors_poll_context_t::updateDecimation()
+{
+    for (int i=0 ; i<numHandles ; i++) {
+        const int group = handleToRateGroup(sSensorList[i].handle);
+        int64_t fastest = -1;
+        for (int j=0 ; j<numHandles ; j++) {
+            if (!mHandleEnabled[j] || mRequestedPeriod[j] < 0 ||
+                handleToRateGroup(sSensorList[j].handle) != group)
+                continue;
+            if (fastest < 0 || mRequestedPeriod[j] < fastest)
+                fastest = mRequestedPeriod[j];
+        }
+        mDecimatePeriod[i] = mContinuous[i] && fastest >= 0 &&
+                mRequestedPeriod[i] > fastest ? mRequestedPeriod[i] : 0;
+    }
+}
+
+/* Drops samples of handles running faster than they asked for because
+ * another handle shares their hardware. Returns the number of events kept. */
+int sensors_poll_context_t::decimate(sensors_event_t* data, int count)
+{
+    int kept = 0;
+    const int64_t now = getMonotonicTime();
+    pthread_mutex_lock(&mRateLock);
+    for (int i=0 ; i<count ; i++) {
+        const int slot = data[i].type == SENSOR_TYPE_META_DATA ?
+                -EINVAL : handleToSlot(data[i].sensor);
+        const int64_t t = data[i].timestamp;
+        if (slot >= 0 && mDecimatePeriod[slot]) {
+            const int64_t period = mDecimatePeriod[slot];
+            // tolerate an eighth of a period of jitter
+            if (t < mNextReport[slot] - period / 8) {
+                mStats[slot].dropped++;
+                continue;
+            }
+            if (t - mNextReport[slot] >= period)
+                mNextReport[slot] = t + period;
+            else
+                mNextReport[slot] += period;
+        }
+        if (slot >= 0) {
+            sensors_handle_stats_t& st = mStats[slot];
+            if (!st.delivered)
+                st.first_timestamp = t;
+            st.last_timestamp = t;
+            st.delivered++;
+            int64_t latency_ms = (now - t) / 1000000;
+            int b = 0;
+            while (b < SENSORS_LATENCY_BUCKETS-1 && latency_ms >= (1LL << b))
+                b++;
+            st.latency[b]++;
+        }
+        if (kept != i)
+            data[kept] = data[i];
+        kept++;
+    }
+    pthread_mutex_unlock(&mRateLock);
+    return kept;
+}
+
+int sensors_poll_context_t::batch(int handle, int flags, int64_t period_ns,
+                                  int64_t timeout)
+{
+    FUNC_LOG;
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+    if (index == mpl) {
+        // the MPL has no FIFO and reports every sample as it arrives
+        if (timeout > 0) return -EINVAL;
+        if (flags & SENSORS_BATCH_DRY_RUN) return 0;
+        return setRate(handle, period_ns);
+    }
+    int err = ((SamsungSensorBase*)mSensors[index])->batch(handle, flags,
+                                                          period_ns, timeout);
+    if (!err && !(flags & SENSORS_BATCH_DRY_RUN)) {
+        // on-change sensors have no poll_delay, so a failure is not fatal
+        setRate(handle, period_ns);
+        // the poll timeout depends on the new latency
+        sendWakeMessage();
+    }
+    return err;
+}
+
+int sensors_poll_context_t::flush(int handle)
+{
+    FUNC_LOG;
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+    int err = 0;
+    if (index == mpl) {
+        const int slot = handleToSlot(handle);
+        if (slot < 0) return slot;
+        pthread_mutex_lock(&mRateLock);
+        const bool enabled = mHandleEnabled[slot];
+        pthread_mutex_unlock(&mRateLock);
+        if (!enabled)
+            return -EINVAL;
+        pthread_mutex_lock(&mFlushLock);
+        if (mNumMplFlushes < MAX_MPL_FLUSHES)
+            mMplFlushes[mNumMplFlushes++] = handle;
+        else
+            err = -ENOMEM;
+        pthread_mutex_unlock(&mFlushLock);
+    } else {
+        err = ((SamsungSensorBase*)mSensors[index])->flush(handle);
+    }
+    if (!err) {
+        sendWakeMessage();
+    }
+    return err;
+}
+
+int sensors_poll_context_t::readMplFlushes(sensors_event_t* data, int count)
+{
+    int nb = 0;
+    pthread_mutex_lock(&mFlushLock);
+    while (nb < count && nb < mNumMplFlushes) {
+        memset(&data[nb], 0, sizeof(data[nb]));
+        data[nb].version = META_DATA_VERSION;
+        data[nb].type = SENSOR_TYPE_META_DATA;
+        data[nb].meta_data.what = META_DATA_FLUSH_COMPLETE;
+        data[nb].meta_data.sensor = mMplFlushes[nb];
+        nb++;
+    }
+    mNumMplFlushes -= nb;
+    memmove(mMplFlushes, mMplFlushes + nb, mNumMplFlushes * sizeof(int));
+    pthread_mutex_unlock(&mFlushLock);
+    return nb;
+}
+
+/* Wait no longer than it takes for the oldest batched sample to reach its
+ * report latency, and not at all while a driver still has input to read,
+ * e.g. an owner that stopped for a full sibling. */
+int sensors_poll_context_t::getPollTimeout()
+{
+    int64_t deadline = -1;
+    for (int i = light; i < numSensorDrivers; i++) {
+        if (!mSensors[i])
+            continue;
+        if (mSensors[i]->hasPendingEvents())
+            return 0;
+        int64_t d = ((SamsungSensorBase*)mSensors[i])->getFifoDeadline();
+        if (d >= 0 && (deadline < 0 || d < deadline))
+            deadline = d;
+    }
+    if (deadline < 0)
+        return -1;
+
+    int64_t now = getMonotonicTime();
+    if (deadline <= now)
+        return 0;
+    return (deadline - now + 999999) / 1000000;
+}
+
+/* Drains the wake-up drivers ahead of everything else and takes the HAL
+ * wakelock if that produced anything; pollEvents() drops it on the next call. */
+int sensors_poll_context_t::readWakeUpEvents(sensors_event_t* data, int count)
+{
+    if (!count || !(mReady[proximity] || driverHasPendingEvents(proximity)))
+        return 0;
+
+    int nb = readDriverEvents(proximity, data, count);
+    if (nb < count)
+        mReady[proximity] = false;
+    nb = decimate(data, nb);
+    if (nb > 0 && !mWakeLockHeld) {
+        acquire_wake_lock(PARTIAL_WAKE_LOCK, SENSORS_WAKE_LOCK);
+        mWakeLockHeld = true;
+    }
+    return nb;
 }
 
 int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
@@ -292,16 +946,36 @@ int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
     int n = 0;
     int polltime = -1;
 
+    // the framework only calls back once it has taken the last batch, which
+    // includes any wake-up events we were holding the wakelock for
+    if (mWakeLockHeld) {
+        release_wake_lock(SENSORS_WAKE_LOCK);
+        mWakeLockHeld = false;
+    }
+
     do {
+        // wake-up events go first, so they are never left behind a full batch
+        int nbWakeUp = readWakeUpEvents(data, count);
+        count -= nbWakeUp;
+        nbEvents += nbWakeUp;
+        data += nbWakeUp;
+
+        int nbFlushes = readMplFlushes(data, count);
+        count -= nbFlushes;
+        nbEvents += nbFlushes;
+        data += nbFlushes;
+
         // see if we have some leftover from the last poll()
         for (int i=0 ; count && i<numSensorDrivers ; i++) {
-            SensorBase* const sensor(mSensors[i]);
-            if ((mPollFds[i].revents & POLLIN) || (sensor->hasPendingEvents())) {
-                int nb = sensor->readEvents(data, count);
+            if (i == proximity)
+                continue;
+            if (mReady[i] || driverHasPendingEvents(i)) {
+                int nb = readDriverEvents(i, data, count);
                 if (nb < count) {
                     // no more data for this sensor
-                    mPollFds[i].revents = 0;
+                    mReady[i] = false;
                 }
+                nb = decimate(data, nb);
                 count -= nb;
                 nbEvents += nb;
                 data += nb;
@@ -309,12 +983,12 @@ int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
                 //special handling for the mpl, which has multiple handles
                 if(i==mpl) {
                     i+=2; //skip accel and timer
-                    mPollFds[mpl_accel].revents = 0;
-                    mPollFds[mpl_timer].revents = 0;
+                    mReady[mpl_accel] = false;
+                    mReady[mpl_timer] = false;
                 }
                 if(i==mpl_accel) {
                     i+=1; //skip timer
-                    mPollFds[mpl_timer].revents = 0;
+                    mReady[mpl_timer] = false;
                 }
             }
         }
@@ -323,29 +997,41 @@ int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
             // we still have some room, so try to see if we can get
             // some events immediately or just wait if we don't have
             // anything to return
-            int i;
+            struct epoll_event events[numFds];
 
+            polltime = nbEvents ? 0 : getPollTimeout();
             do {
-                n = poll(mPollFds, numFds, nbEvents ? 0 : polltime);
+                n = epoll_wait(mEpollFd, events, numFds, polltime);
             } while (n < 0 && errno == EINTR);
             if (n<0) {
-                ALOGE("poll() failed (%s)", strerror(errno));
+                ALOGE("epoll_wait() failed (%s)", strerror(errno));
                 return -errno;
             }
-            if (mPollFds[wake].revents & POLLIN) {
-                char msg;
-                int result = read(mPollFds[wake].fd, &msg, 1);
-                ALOGE_IF(result<0, "error reading from wake pipe (%s)", strerror(errno));
-                ALOGE_IF(msg != WAKE_MESSAGE, "unknown message on wake queue (0x%02x)", int(msg));
-                mPollFds[wake].revents = 0;
-            }
-            if(mPollFds[mpl_power].revents & POLLIN) {
-                ((MPLSensor*)mSensors[mpl])->handlePowerEvent();
-                mPollFds[mpl_power].revents = 0;
+            for (int i=0 ; i<n ; i++) {
+                const uint32_t index = events[i].data.u32;
+                if (index == wake) {
+                    // edge-triggered, so empty the pipe before waiting again
+                    char msg[16];
+                    int result;
+                    while ((result = read(mPollFds[wake], msg, sizeof(msg))) > 0) {
+                        for (int j=0 ; j<result ; j++) {
+                            ALOGE_IF(msg[j] != WAKE_MESSAGE,
+                                     "unknown message on wake queue (0x%02x)", int(msg[j]));
+                        }
+                    }
+                    ALOGE_IF(result<0 && errno != EAGAIN,
+                             "error reading from wake pipe (%s)", strerror(errno));
+                } else if (index == mpl_power) {
+                    ((MPLSensor*)mSensors[mpl])->handlePowerEvent();
+                } else if (index < numSensorDrivers) {
+                    mReady[index] = true;
+                }
             }
         }
-        // if we have events and space, go read them
-    } while (n && count);
+        // if we have events and space, go read them; a timeout means a
+        // batch has reached its report latency, and no wait at all with
+        // nothing read yet that a driver has more
+    } while ((n || polltime > 0 || (polltime == 0 && !nbEvents)) && count);
 
     return nbEvents;
 }
@@ -386,6 +1072,22 @@ static int poll__poll(struct sensors_poll_device_t *dev,
     return ctx->pollEvents(data, count);
 }
 
+static int poll__batch(struct sensors_poll_device_1 *dev,
+                       int handle, int flags, int64_t period_ns,
+                       int64_t timeout)
+{
+    FUNC_LOG;
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->batch(handle, flags, period_ns, timeout);
+}
+
+static int poll__flush(struct sensors_poll_device_1 *dev, int handle)
+{
+    FUNC_LOG;
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->flush(handle);
+}
+
 /*****************************************************************************/
 
 /** Open a new instance of a sensor device using name */
@@ -396,15 +1098,17 @@ static int open_sensors(const struct hw_module_t* module, const char* id,
     int status = -EINVAL;
     sensors_poll_context_t *dev = new sensors_poll_context_t();
 
-    memset(&dev->device, 0, sizeof(sensors_poll_device_t));
+    memset(&dev->device, 0, sizeof(sensors_poll_device_1));
 
     dev->device.common.tag = HARDWARE_DEVICE_TAG;
-    dev->device.common.version  = 0;
+    dev->device.common.version  = SENSORS_DEVICE_API_VERSION_1_1;
     dev->device.common.module   = const_cast<hw_module_t*>(module);
     dev->device.common.close    = poll__close;
     dev->device.activate        = poll__activate;
     dev->device.setDelay        = poll__setDelay;
     dev->device.poll            = poll__poll;
+    dev->device.batch           = poll__batch;
+    dev->device.flush           = poll__flush;
 
     *device = &dev->device.common;
     status = 0;
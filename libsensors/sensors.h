@@ -38,6 +38,55 @@ __BEGIN_DECLS
 #define ID_P  (ID_L + 1)
 #define ID_PR (ID_P + 1)
 #define ID_T  (ID_PR + 1)
+#define ID_ALT (ID_T + 1)
+#define ID_PT (ID_ALT + 1)
+
+/*
+ * Sensors derived from the barometer inside the HAL, so that apps do not
+ * each have to keep it running at full rate. Both report in data[0] and
+ * only when their value has moved:
+ *  - altitude, in metres, against the sea level pressure in
+ *    persist.sensors.sea_level_hpa, or the standard atmosphere
+ *  - pressure tendency, the change in hPa over the last three hours
+ */
+#define SENSOR_TYPE_TUNA_ALTITUDE           (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 0)
+#define SENSOR_STRING_TYPE_TUNA_ALTITUDE    "com.samsung.tuna.altitude"
+#define SENSOR_TYPE_TUNA_PRESSURE_TENDENCY  (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 1)
+#define SENSOR_STRING_TYPE_TUNA_PRESSURE_TENDENCY \
+        "com.samsung.tuna.pressure_tendency"
+
+/*****************************************************************************/
+
+/*
+ * Per-handle delivery statistics. When debug.sensors.stats is set, the HAL
+ * writes a sensors_stats_header_t followed by one sensors_handle_stats_t
+ * per sensor to SENSORS_STATS_FILE each time a sensor is deactivated.
+ */
+#define SENSORS_STATS_FILE      "/data/system/sensors.tuna.stats"
+#define SENSORS_STATS_PROPERTY  "debug.sensors.stats"
+#define SENSORS_STATS_MAGIC     0x53535453  /* 'SSTS' */
+#define SENSORS_STATS_VERSION   1
+
+/* kernel timestamp to delivery latency: <1ms, <2ms, <4ms ... >=1024ms */
+#define SENSORS_LATENCY_BUCKETS 12
+
+struct sensors_stats_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t record_size;
+};
+
+struct sensors_handle_stats_t {
+    int32_t handle;
+    int32_t enabled;
+    int64_t requested_period_ns;
+    uint64_t delivered;
+    uint64_t dropped;           /* decimated for a slower client */
+    int64_t first_timestamp;    /* of the first sample since enable */
+    int64_t last_timestamp;
+    uint32_t latency[SENSORS_LATENCY_BUCKETS];
+};
 
 /*****************************************************************************/
 
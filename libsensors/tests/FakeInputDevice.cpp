@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <linux/input.h>
+
+#include "FakeInputDevice.h"
+
+/*****************************************************************************/
+
+static const char *sNodes[] = { "enable", "poll_delay" };
+
+static void makeDirs(const char *dir)
+{
+    char path[PATH_MAX];
+    strncpy(path, dir, sizeof(path) - 1);
+    path[sizeof(path) - 1] = 0;
+    for (char *p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = 0;
+            mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+    mkdir(path, 0755);
+}
+
+FakeInputDevice::FakeInputDevice(const char *name)
+    : mWriteFd(-1)
+{
+    strncpy(mName, name, sizeof(mName) - 1);
+    mName[sizeof(mName) - 1] = 0;
+
+    char path[PATH_MAX];
+    makePath(path, sizeof(path), NULL);
+    makeDirs(path);
+    for (size_t i = 0; i < sizeof(sNodes) / sizeof(sNodes[0]); i++) {
+        makePath(path, sizeof(path), sNodes[i]);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+FakeInputDevice::~FakeInputDevice()
+{
+    char path[PATH_MAX];
+    for (size_t i = 0; i < sizeof(sNodes) / sizeof(sNodes[0]); i++) {
+        makePath(path, sizeof(path), sNodes[i]);
+        unlink(path);
+    }
+    makePath(path, sizeof(path), NULL);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s%s", SAMSUNG_SENSOR_SYSFS_ROOT, mName);
+    rmdir(path);
+    if (mWriteFd >= 0)
+        close(mWriteFd);
+}
+
+/* <root>/<name>/device[/<file>], the layout SamsungSensorBase expects. */
+int FakeInputDevice::makePath(char *path, size_t len, const char *file) const
+{
+    return snprintf(path, len, "%s%s/device%s%s", SAMSUNG_SENSOR_SYSFS_ROOT,
+                    mName, file ? "/" : "", file ? file : "");
+}
+
+int FakeInputDevice::attach(SamsungSensorBase *sensor)
+{
+    int fds[2];
+    if (mWriteFd >= 0)
+        return -EBUSY;
+    if (pipe(fds) < 0)
+        return -errno;
+    // a driver that stops reading makes send() fail instead of blocking
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    int err = sensor->useInput(fds[0], mName);
+    if (err < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return err;
+    }
+    mWriteFd = fds[1];
+    return 0;
+}
+
+int FakeInputDevice::sendBytes(const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+    while (len) {
+        ssize_t n = write(mWriteFd, p, len);
+        if (n < 0)
+            return -errno;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int FakeInputDevice::send(const input_event *events, size_t count)
+{
+    return sendBytes(events, count * sizeof(*events));
+}
+
+/* One EV_ABS report closed by EV_SYN, stamped like evdev does when it is
+ * left on CLOCK_REALTIME, which it has to be for a pipe. */
+int FakeInputDevice::report(int code, int value)
+{
+    input_event events[2];
+    memset(events, 0, sizeof(events));
+    gettimeofday(&events[0].time, NULL);
+    events[0].type = EV_ABS;
+    events[0].code = code;
+    events[0].value = value;
+    events[1].time = events[0].time;
+    events[1].type = EV_SYN;
+    events[1].code = SYN_REPORT;
+    return send(events, 2);
+}
+
+/* Sends a recording of raw input_events, e.g. captured from the device
+ * with cat /dev/input/eventN. The recording has to fit in the pipe, about
+ * 2700 events, unless the driver reads concurrently. Returns the number of
+ * events sent. */
+int FakeInputDevice::replay(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+
+    input_event events[64];
+    int count = 0;
+    ssize_t n;
+    while ((n = read(fd, events, sizeof(events))) > 0) {
+        // a truncated last event is dropped, as evdev would never send it
+        size_t num = n / sizeof(events[0]);
+        int err = send(events, num);
+        if (err < 0) {
+            close(fd);
+            return err;
+        }
+        count += num;
+    }
+    int err = n < 0 ? -errno : count;
+    close(fd);
+    return err;
+}
+
+int FakeInputDevice::readSysfs(const char *file, char *buf, size_t len) const
+{
+    char path[PATH_MAX];
+    makePath(path, sizeof(path), file);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0)
+        return -errno;
+    buf[n] = 0;
+    return n;
+}
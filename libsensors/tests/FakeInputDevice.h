@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FAKE_INPUT_DEVICE_H
+#define ANDROID_FAKE_INPUT_DEVICE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "SamsungSensorBase.h"
+
+/*****************************************************************************/
+
+/*
+ * Stands in for a sensor's evdev node and its sysfs directory, so the
+ * Samsung drivers can run on a build host. The sysfs nodes are plain files
+ * under SAMSUNG_SENSOR_SYSFS_ROOT; input events reach the driver through a
+ * pipe, either generated or replayed from a recording of raw input_events
+ * as read from /dev/input/eventN.
+ */
+class FakeInputDevice
+{
+    char mName[32];
+    int mWriteFd;
+
+    int makePath(char *path, size_t len, const char *file) const;
+
+public:
+    FakeInputDevice(const char *name);
+    ~FakeInputDevice();
+
+    /* Creates the sysfs nodes and makes the sensor read from this device. */
+    int attach(SamsungSensorBase *sensor);
+
+    int send(const input_event *events, size_t count);
+    /* Any slice of the event stream, to split events across reads. */
+    int sendBytes(const void *buf, size_t len);
+    int report(int code, int value);
+    int replay(const char *path);
+
+    /* Last value the driver wrote to a sysfs node, e.g. "enable". */
+    int readSysfs(const char *file, char *buf, size_t len) const;
+};
+
+/*****************************************************************************/
+
+#endif  /* ANDROID_FAKE_INPUT_DEVICE_H */
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/input.h>
+
+#include <gtest/gtest.h>
+
+#include "InputEventReader.h"
+
+/*
+ * Feeds InputEventCircularReader through a pipe, with the event stream cut
+ * at arbitrary byte offsets, and checks every event comes back whole, once
+ * and in order, including across the wrap of the ring.
+ */
+class InputEventReaderTest : public ::testing::Test {
+protected:
+    int mFds[2];
+    uint32_t mSeed;
+    unsigned mWritten;      // events handed to the pipe, whole or not
+    size_t mWriteOffset;    // bytes of event mWritten already written
+    unsigned mRead;         // events read back
+
+    virtual void SetUp() {
+        ASSERT_EQ(0, pipe(mFds));
+        fcntl(mFds[0], F_SETFL, O_NONBLOCK);
+        // a reader that loses events lets the pipe fill up; fail, don't hang
+        fcntl(mFds[1], F_SETFL, O_NONBLOCK);
+        mSeed = 1;
+        mWritten = 0;
+        mWriteOffset = 0;
+        mRead = 0;
+    }
+
+    virtual void TearDown() {
+        close(mFds[0]);
+        close(mFds[1]);
+    }
+
+    // deterministic, so a failure can be reproduced
+    uint32_t random(uint32_t range) {
+        mSeed = mSeed * 1103515245 + 12345;
+        return (mSeed >> 16) % range;
+    }
+
+    static void makeEvent(unsigned n, input_event* ev) {
+        memset(ev, 0, sizeof(*ev));
+        ev->time.tv_sec = n / 1000;
+        ev->time.tv_usec = n % 1000;
+        ev->type = n % 4 == 3 ? EV_SYN : EV_ABS;
+        ev->code = n % 4 == 3 ? SYN_REPORT : ABS_MISC;
+        ev->value = n;
+    }
+
+    // writes the next nbytes of the event stream
+    void writeBytes(size_t nbytes) {
+        while (nbytes) {
+            input_event ev;
+            makeEvent(mWritten, &ev);
+            size_t len = sizeof(ev) - mWriteOffset;
+            if (len > nbytes)
+                len = nbytes;
+            ASSERT_EQ((ssize_t)len,
+                      write(mFds[1], (char*)&ev + mWriteOffset, len));
+            nbytes -= len;
+            mWriteOffset += len;
+            if (mWriteOffset == sizeof(ev)) {
+                mWriteOffset = 0;
+                mWritten++;
+            }
+        }
+    }
+
+    // consumes up to max events, checking each one
+    void readEvents(InputEventCircularReader& reader, unsigned max) {
+        input_event const* ev;
+        for (unsigned i = 0; i < max && reader.readEvent(mFds[0], &ev); i++) {
+            input_event expected;
+            makeEvent(mRead, &expected);
+            ASSERT_LT(mRead, mWritten);
+            ASSERT_EQ(0, memcmp(&expected, ev, sizeof(expected)))
+                    << "event " << mRead << " came back as " << ev->value;
+            reader.next();
+            mRead++;
+        }
+    }
+
+    void readAll(InputEventCircularReader& reader) {
+        readEvents(reader, ~0u);
+    }
+};
+
+TEST_F(InputEventReaderTest, EmptyPipe) {
+    InputEventCircularReader reader(4);
+    input_event const* ev;
+    EXPECT_FALSE(reader.readEvent(mFds[0], &ev));
+    EXPECT_EQ(-EAGAIN, reader.fill(mFds[0]));
+}
+
+TEST_F(InputEventReaderTest, WholeEventsAcrossWrap) {
+    InputEventCircularReader reader(3);
+    for (int i = 0; i < 100; i++) {
+        size_t chunk = (1 + random(5)) * sizeof(input_event);
+        ASSERT_NO_FATAL_FAILURE(writeBytes(chunk));
+        ASSERT_NO_FATAL_FAILURE(readAll(reader));
+        ASSERT_EQ(mWritten, mRead);
+    }
+}
+
+TEST_F(InputEventReaderTest, PartialEventIsHeldBack) {
+    InputEventCircularReader reader(4);
+    ASSERT_NO_FATAL_FAILURE(writeBytes(sizeof(input_event) + 5));
+    ASSERT_NO_FATAL_FAILURE(readAll(reader));
+    EXPECT_EQ(1u, mRead);
+
+    // nothing whole yet
+    ASSERT_NO_FATAL_FAILURE(writeBytes(sizeof(input_event) - 6));
+    ASSERT_NO_FATAL_FAILURE(readAll(reader));
+    EXPECT_EQ(1u, mRead);
+
+    ASSERT_NO_FATAL_FAILURE(writeBytes(1));
+    ASSERT_NO_FATAL_FAILURE(readAll(reader));
+    EXPECT_EQ(2u, mRead);
+}
+
+TEST_F(InputEventReaderTest, SplitAtEveryOffset) {
+    for (size_t split = 1; split < sizeof(input_event); split++) {
+        SCOPED_TRACE(split);
+        InputEventCircularReader reader(3);
+        mWritten = mRead = 0;
+        mWriteOffset = 0;
+        // 3 events per chunk plus a few bytes, so the split moves through
+        // every slot of the ring
+        for (int i = 0; i < 50; i++) {
+            ASSERT_NO_FATAL_FAILURE(writeBytes(split));
+            ASSERT_NO_FATAL_FAILURE(readAll(reader));
+            ASSERT_NO_FATAL_FAILURE(writeBytes(3 * sizeof(input_event) - split));
+            ASSERT_NO_FATAL_FAILURE(readAll(reader));
+        }
+        ASSERT_EQ(mWritten, mRead);
+    }
+}
+
+TEST_F(InputEventReaderTest, RandomSplits) {
+    static const size_t sizes[] = { 1, 2, 7, 64, 1024 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        SCOPED_TRACE(sizes[s]);
+        InputEventCircularReader reader(sizes[s]);
+        mWritten = mRead = 0;
+        mWriteOffset = 0;
+        while (mWritten < 50000) {
+            size_t chunk = 1 + random(3 * sizeof(input_event));
+            ASSERT_NO_FATAL_FAILURE(writeBytes(chunk));
+            // stop partway through what is buffered now and then
+            ASSERT_NO_FATAL_FAILURE(readEvents(reader, 1 + random(8)));
+            if (mWritten - mRead > 1000) {
+                ASSERT_NO_FATAL_FAILURE(readAll(reader));
+            }
+        }
+        // complete the last event and collect everything
+        if (mWriteOffset) {
+            ASSERT_NO_FATAL_FAILURE(writeBytes(sizeof(input_event) - mWriteOffset));
+        }
+        ASSERT_NO_FATAL_FAILURE(readAll(reader));
+        ASSERT_EQ(mWritten, mRead);
+    }
+}
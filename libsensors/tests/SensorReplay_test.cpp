@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <linux/input.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "sensors.h"
+#include "LightSensor.h"
+#include "PressureSensor.h"
+#include "TemperatureSensor.h"
+#include "AltitudeSensor.h"
+#include "PressureTendencySensor.h"
+#include "FakeInputDevice.h"
+
+/*
+ * Runs the Samsung drivers against FakeInputDevice: the control writes land
+ * in the fake sysfs nodes and the events sent or replayed come back out of
+ * readEvents() converted.
+ */
+
+static int64_t monotonicNow()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/* Reads the drivers in order, owner first, a few events at a time like the
+ * poll loop does, until none of them has anything left. Each driver's
+ * events are appended to its own list. */
+static void pollAll(SamsungSensorBase **drivers, int num,
+                    std::vector<sensors_event_t> *events)
+{
+    for (int round = 0; round < 10000; round++) {
+        bool more = false;
+        for (int i = 0; i < num; i++) {
+            sensors_event_t buf[16];
+            int nb = drivers[i]->readEvents(buf, 16);
+            ASSERT_LE(0, nb);
+            events[i].insert(events[i].end(), buf, buf + nb);
+            more = more || nb || drivers[i]->hasPendingEvents();
+        }
+        if (!more)
+            return;
+    }
+    FAIL() << "drivers never ran out of events";
+}
+
+/* One BMP180 report every period, stamped in the past so the whole
+ * recording is a backlog already waiting to be read. */
+static void makeBarometerReports(input_event *report, int reports,
+                                 int64_t period, int pressure, int step)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    const int64_t start = (now.tv_sec * 1000000LL + now.tv_usec) * 1000 -
+            (reports + 1) * period;
+    memset(report, 0, reports * 3 * sizeof(*report));
+    for (int i = 0; i < reports; i++) {
+        const int64_t t = start + i * period;
+        input_event *ev = &report[i * 3];
+        ev[0].time.tv_sec = t / 1000000000;
+        ev[0].time.tv_usec = t % 1000000000 / 1000;
+        ev[0].type = EV_ABS;
+        ev[0].code = ABS_PRESSURE;
+        ev[0].value = pressure + i * step;
+        ev[1].time = ev[0].time;
+        ev[1].type = EV_ABS;
+        ev[1].code = ABS_MISC;
+        ev[1].value = i;
+        ev[2].time = ev[0].time;
+        ev[2].type = EV_SYN;
+    }
+}
+
+TEST(SensorReplayTest, LightEnableAndOnChange) {
+    FakeInputDevice dev("input0");
+    LightSensor light;
+    ASSERT_EQ(0, dev.attach(&light));
+
+    char buf[32];
+    ASSERT_EQ(0, light.enable(ID_L, 1));
+    ASSERT_LT(0, dev.readSysfs("enable", buf, sizeof(buf)));
+    EXPECT_STREQ("1", buf);
+
+    // repeats and single count jitter are filtered out
+    ASSERT_EQ(0, dev.report(ABS_MISC, 100));
+    ASSERT_EQ(0, dev.report(ABS_MISC, 100));
+    ASSERT_EQ(0, dev.report(ABS_MISC, 101));
+    ASSERT_EQ(0, dev.report(ABS_MISC, 200));
+
+    sensors_event_t events[8];
+    ASSERT_EQ(2, light.readEvents(events, 8));
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(ID_L, events[i].sensor);
+        EXPECT_EQ(SENSOR_TYPE_LIGHT, events[i].type);
+        // realtime evdev stamps are moved to the monotonic clock
+        EXPECT_LT(llabs(monotonicNow() - events[i].timestamp), 1000000000LL);
+    }
+    EXPECT_LT(events[0].light, events[1].light);
+    EXPECT_LE(events[0].timestamp, events[1].timestamp);
+
+    ASSERT_EQ(0, light.enable(ID_L, 0));
+    ASSERT_LT(0, dev.readSysfs("enable", buf, sizeof(buf)));
+    EXPECT_STREQ("0", buf);
+    ASSERT_EQ(0, dev.report(ABS_MISC, 300));
+    EXPECT_EQ(0, light.readEvents(events, 8));
+}
+
+TEST(SensorReplayTest, SplitReport) {
+    FakeInputDevice dev("input0");
+    LightSensor light;
+    ASSERT_EQ(0, dev.attach(&light));
+    ASSERT_EQ(0, light.enable(ID_L, 1));
+
+    input_event report[2];
+    memset(report, 0, sizeof(report));
+    report[0].type = EV_ABS;
+    report[0].code = ABS_MISC;
+    report[0].value = 500;
+    report[1].type = EV_SYN;
+
+    sensors_event_t event;
+    ASSERT_EQ(0, dev.sendBytes(report, 5));
+    EXPECT_EQ(0, light.readEvents(&event, 1));
+    ASSERT_EQ(0, dev.sendBytes((const char *)report + 5, sizeof(report) - 5));
+    ASSERT_EQ(1, light.readEvents(&event, 1));
+    EXPECT_EQ(ID_L, event.sensor);
+}
+
+TEST(SensorReplayTest, PressureFeedsTemperature) {
+    FakeInputDevice dev("input1");
+    PressureSensor pressure;
+    TemperatureSensor temperature(&pressure);
+    ASSERT_EQ(0, dev.attach(&pressure));
+
+    char buf[32];
+    ASSERT_EQ(0, pressure.enable(ID_PR, 1));
+    ASSERT_EQ(0, temperature.enable(ID_T, 1));
+    ASSERT_EQ(0, temperature.setDelay(ID_T, 200000000));
+    ASSERT_LT(0, dev.readSysfs("poll_delay", buf, sizeof(buf)));
+    EXPECT_STREQ("200000000", buf);
+    // the poll loop runs each driver with a control message queued, which
+    // lets the sibling see it is enabled before its owner forwards to it
+    sensors_event_t event;
+    ASSERT_EQ(0, temperature.readEvents(&event, 1));
+
+    input_event report[3];
+    memset(report, 0, sizeof(report));
+    report[0].type = EV_ABS;
+    report[0].code = ABS_PRESSURE;
+    report[0].value = 101325;
+    report[1].type = EV_ABS;
+    report[1].code = ABS_MISC;
+    report[1].value = 250;
+    report[2].type = EV_SYN;
+    ASSERT_EQ(0, dev.send(report, 3));
+
+    ASSERT_EQ(1, pressure.readEvents(&event, 1));
+    EXPECT_EQ(ID_PR, event.sensor);
+    EXPECT_FLOAT_EQ(1013.25f, event.pressure);
+    ASSERT_EQ(1, temperature.readEvents(&event, 1));
+    EXPECT_EQ(ID_T, event.sensor);
+    EXPECT_FLOAT_EQ(25.0f, event.temperature);
+
+    // the device stays on while the other sensor needs it
+    ASSERT_EQ(0, pressure.enable(ID_PR, 0));
+    ASSERT_LT(0, dev.readSysfs("enable", buf, sizeof(buf)));
+    EXPECT_STREQ("1", buf);
+    ASSERT_EQ(0, temperature.enable(ID_T, 0));
+    ASSERT_LT(0, dev.readSysfs("enable", buf, sizeof(buf)));
+    EXPECT_STREQ("0", buf);
+}
+
+TEST(SensorReplayTest, ReplayRecording) {
+    char path[] = "/tmp/sensors_replay_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_LE(0, fd);
+    const int reports = 100;
+    for (int i = 0; i < reports; i++) {
+        input_event report[2];
+        memset(report, 0, sizeof(report));
+        gettimeofday(&report[0].time, NULL);
+        report[0].type = EV_ABS;
+        report[0].code = ABS_MISC;
+        report[0].value = i % 2 ? 10 : 20;
+        report[1].time = report[0].time;
+        report[1].type = EV_SYN;
+        ASSERT_EQ((ssize_t)sizeof(report), write(fd, report, sizeof(report)));
+    }
+    close(fd);
+
+    FakeInputDevice dev("input0");
+    LightSensor light;
+    ASSERT_EQ(0, dev.attach(&light));
+    ASSERT_EQ(0, light.enable(ID_L, 1));
+    EXPECT_EQ(reports * 2, dev.replay(path));
+    unlink(path);
+
+    sensors_event_t events[reports];
+    ASSERT_EQ(reports, light.readEvents(events, reports));
+    for (int i = 1; i < reports; i++)
+        EXPECT_NE(events[i - 1].light, events[i].light);
+}
+
+TEST(SensorReplayTest, FlushNeedsActivation) {
+    FakeInputDevice dev("input0");
+    LightSensor light;
+    ASSERT_EQ(0, dev.attach(&light));
+    EXPECT_EQ(-EINVAL, light.flush(ID_L));
+
+    ASSERT_EQ(0, light.enable(ID_L, 1));
+    ASSERT_EQ(0, light.flush(ID_L));
+    sensors_event_t event;
+    ASSERT_EQ(1, light.readEvents(&event, 1));
+    EXPECT_EQ(SENSOR_TYPE_META_DATA, event.type);
+    EXPECT_EQ(META_DATA_FLUSH_COMPLETE, event.meta_data.what);
+    EXPECT_EQ(ID_L, event.meta_data.sensor);
+
+    ASSERT_EQ(0, light.enable(ID_L, 0));
+    EXPECT_EQ(-EINVAL, light.flush(ID_L));
+}
+
+TEST(SensorReplayTest, SmoothedTimestampsNotAfterMeasured) {
+    const int reports = 64;
+    const int64_t period = 20000000;
+    input_event report[reports * 2];
+    memset(report, 0, sizeof(report));
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    // stamped in the past, 20ms apart with up to +-4ms of jitter
+    const int64_t start = (now.tv_sec * 1000000LL + now.tv_usec) * 1000 -
+            (reports + 1) * period;     // whole microseconds, as evdev stamps
+    int64_t raw[reports];
+    uint32_t seed = 1;
+    for (int i = 0; i < reports; i++) {
+        seed = seed * 1103515245 + 12345;
+        raw[i] = start + i * period + ((int64_t)((seed >> 16) % 8001) - 4000) * 1000;
+        report[i * 2].time.tv_sec = raw[i] / 1000000000;
+        report[i * 2].time.tv_usec = raw[i] % 1000000000 / 1000;
+        report[i * 2].type = EV_ABS;
+        report[i * 2].code = ABS_PRESSURE;
+        report[i * 2].value = 100000 + i;
+        report[i * 2 + 1].time = report[i * 2].time;
+        report[i * 2 + 1].type = EV_SYN;
+    }
+
+    FakeInputDevice dev("input1");
+    PressureSensor pressure;
+    ASSERT_EQ(0, dev.attach(&pressure));
+    ASSERT_EQ(0, pressure.enable(ID_PR, 1));
+    ASSERT_EQ(0, dev.send(report, reports * 2));
+
+    sensors_event_t events[reports];
+    ASSERT_EQ(reports, pressure.readEvents(events, reports));
+    // the first sample is not smoothed, and the rest are converted with the
+    // same clock offset, so each measured time follows from it
+    for (int i = 1; i < reports; i++) {
+        SCOPED_TRACE(i);
+        const int64_t measured = events[0].timestamp + (raw[i] - raw[0]);
+        EXPECT_LE(events[i].timestamp, measured);
+        EXPECT_LT(events[i - 1].timestamp, events[i].timestamp);
+    }
+}
+
+TEST(SensorReplayTest, SiblingKeepsUpWithBacklog) {
+    // far more reports than a sibling's forward ring holds
+    const int reports = 4 * SAMSUNG_SENSOR_FORWARD_SIZE;
+    input_event report[reports * 3];
+    makeBarometerReports(report, reports, 20000000, 100000, 1);
+
+    FakeInputDevice dev("input1");
+    PressureSensor pressure;
+    TemperatureSensor temperature(&pressure);
+    ASSERT_EQ(0, dev.attach(&pressure));
+    ASSERT_EQ(0, pressure.enable(ID_PR, 1));
+    // batching, so the owner reads well past what the caller has room for
+    ASSERT_EQ(0, pressure.batch(ID_PR, 0, 20000000, 10000000000LL));
+    ASSERT_EQ(0, temperature.enable(ID_T, 1));
+    sensors_event_t event;
+    ASSERT_EQ(0, temperature.readEvents(&event, 1));
+    ASSERT_EQ(0, dev.send(report, reports * 3));
+
+    SamsungSensorBase *drivers[] = { &pressure, &temperature };
+    std::vector<sensors_event_t> events[2];
+    ASSERT_NO_FATAL_FAILURE(pollAll(drivers, 2, events));
+    ASSERT_EQ(0, pressure.flush(ID_PR));
+    ASSERT_NO_FATAL_FAILURE(pollAll(drivers, 2, events));
+    ASSERT_EQ(SENSOR_TYPE_META_DATA, events[0].back().type);
+    events[0].pop_back();
+    ASSERT_EQ((size_t)reports, events[0].size());
+    ASSERT_EQ((size_t)reports, events[1].size());
+    for (int i = 0; i < reports; i++) {
+        EXPECT_FLOAT_EQ((100000 + i) / 100.0f, events[0][i].pressure);
+        EXPECT_FLOAT_EQ(i / 10.0f, events[1][i].temperature);
+    }
+}
+
+TEST(SensorReplayTest, TendencyAndAltitudeAcrossBacklog) {
+    // 10 minutes at about one report a second, rising 1 Pa each; the period
+    // keeps samples off the minute boundaries, which the conversion from
+    // realtime could otherwise move a few microseconds either way
+    const int reports = 600;
+    const int64_t period = 1001000000;
+    input_event report[reports * 3];
+    makeBarometerReports(report, reports, period, 100000, 1);
+
+    // the same recording read as it arrives, then all at once
+    std::vector<sensors_event_t> events[2][2];
+    for (int backlog = 0; backlog < 2; backlog++) {
+        SCOPED_TRACE(backlog);
+        FakeInputDevice dev("input1");
+        PressureSensor pressure;
+        AltitudeSensor altitude(&pressure);
+        PressureTendencySensor tendency(&pressure);
+        ASSERT_EQ(0, dev.attach(&pressure));
+        ASSERT_EQ(0, altitude.enable(ID_ALT, 1));
+        ASSERT_EQ(0, tendency.enable(ID_PT, 1));
+        sensors_event_t event;
+        ASSERT_EQ(0, altitude.readEvents(&event, 1));
+        ASSERT_EQ(0, tendency.readEvents(&event, 1));
+
+        SamsungSensorBase *drivers[] = { &pressure, &altitude, &tendency };
+        std::vector<sensors_event_t> all[3];
+        if (backlog) {
+            ASSERT_EQ(0, dev.send(report, reports * 3));
+            ASSERT_NO_FATAL_FAILURE(pollAll(drivers, 3, all));
+        } else {
+            for (int i = 0; i < reports; i++) {
+                ASSERT_EQ(0, dev.send(&report[i * 3], 3));
+                ASSERT_NO_FATAL_FAILURE(pollAll(drivers, 3, all));
+            }
+        }
+        EXPECT_EQ(0u, all[0].size());
+        events[backlog][0] = all[1];
+        events[backlog][1] = all[2];
+    }
+
+    // a minute of 1 Pa/s is 0.6 hPa, and every closed minute is reported
+    const std::vector<sensors_event_t>& trend = events[1][1];
+    ASSERT_EQ((size_t)(reports / 60 - 2), trend.size());
+    for (size_t i = 0; i < trend.size(); i++)
+        EXPECT_NEAR(0.6f * (i + 1), trend[i].data[0], 0.02f * (i + 1));
+
+    for (int s = 0; s < 2; s++) {
+        ASSERT_EQ(events[0][s].size(), events[1][s].size());
+        for (size_t i = 0; i < events[0][s].size(); i++) {
+            EXPECT_FLOAT_EQ(events[0][s][i].data[0], events[1][s][i].data[0]);
+            EXPECT_EQ(events[0][s][i].sensor, events[1][s][i].sensor);
+        }
+    }
+    EXPECT_LT(10u, events[1][0].size());
+}